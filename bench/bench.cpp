@@ -0,0 +1,652 @@
+#include "agent.h"
+#include "chat.h"
+#include "common.h"
+#include "error.h"
+#include "llama.h"
+#include "model.h"
+#include "prompt_cache.h"
+#include "tool.h"
+#include "tool_executor.h"
+
+#ifdef AGENT_BENCH_MCP
+#include "httplib.h"
+#include "mcp/mcp_client.h"
+#endif
+
+#include <nlohmann/json.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using json = nlohmann::json;
+using clock_type = std::chrono::steady_clock;
+
+struct BenchOptions
+{
+    std::string model_path;  // Model benchmarks are skipped without one
+    std::string output_path; // JSON goes to stdout when empty
+    std::string filter;      // Only run benchmarks whose name contains it
+    double min_time = 0.5;   // Seconds per benchmark
+    int n_prompt = 2048;     // Prompt tokens for the prefill benchmarks
+    int n_gen = 128;         // Generated tokens for the decode benchmark
+};
+
+struct BenchResult
+{
+    std::string name;
+    int64_t iterations = 0;
+    double real_time_ns = 0; // Mean wall time per iteration
+    double items_per_second = 0;
+};
+
+// Runs a function until min_time has passed and records its mean time. The
+// function returns how many items (tokens, calls, bytes) it processed, or 0
+// when throughput is not meaningful.
+class BenchRunner
+{
+  public:
+    explicit BenchRunner(const BenchOptions& options)
+      : options_(options)
+    {
+    }
+
+    [[nodiscard]] bool enabled(const std::string& name) const
+    {
+        return options_.filter.empty() ||
+               name.find(options_.filter) != std::string::npos;
+    }
+
+    template<typename Fn>
+    void run(const std::string& name, Fn&& fn)
+    {
+        if (!enabled(name)) {
+            return;
+        }
+
+        fn(); // Warm-up: caches, lazy initialization, first allocation
+
+        BenchResult result;
+        result.name = name;
+        int64_t n_items = 0;
+        const auto start = clock_type::now();
+        std::chrono::duration<double> elapsed{};
+        do {
+            n_items += fn();
+            result.iterations++;
+            elapsed = clock_type::now() - start;
+        } while (elapsed.count() < options_.min_time);
+
+        result.real_time_ns = elapsed.count() * 1e9 / result.iterations;
+        if (n_items > 0) {
+            result.items_per_second = n_items / elapsed.count();
+        }
+
+        fprintf(stderr,
+                "%-40s %10lld it %14.0f ns/it",
+                name.c_str(),
+                static_cast<long long>(result.iterations),
+                result.real_time_ns);
+        if (n_items > 0) {
+            fprintf(stderr, " %14.1f items/s", result.items_per_second);
+        }
+        fprintf(stderr, "\n");
+        results_.push_back(std::move(result));
+    }
+
+    [[nodiscard]] const std::vector<BenchResult>& results() const
+    {
+        return results_;
+    }
+
+  private:
+    const BenchOptions& options_;
+    std::vector<BenchResult> results_;
+};
+
+// Same shape as Google Benchmark's JSON reporter, so its compare tooling
+// can diff two runs
+json
+to_json(const BenchOptions& options, const std::vector<BenchResult>& results)
+{
+    char date[64];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::gmtime(&now));
+
+    json context = {
+        { "date", date },
+        { "llama_build_number", LLAMA_BUILD_NUMBER },
+        { "llama_commit", LLAMA_COMMIT },
+        { "num_cpus", std::thread::hardware_concurrency() },
+        { "model", options.model_path },
+    };
+
+    json benchmarks = json::array();
+    for (const auto& result : results) {
+        json entry = {
+            { "name", result.name },
+            { "run_name", result.name },
+            { "run_type", "iteration" },
+            { "iterations", result.iterations },
+            { "real_time", result.real_time_ns },
+            { "time_unit", "ns" },
+        };
+        if (result.items_per_second > 0) {
+            entry["items_per_second"] = result.items_per_second;
+        }
+        benchmarks.push_back(std::move(entry));
+    }
+    return { { "context", context }, { "benchmarks", benchmarks } };
+}
+
+// --- Parsing --------------------------------------------------------------
+
+std::string
+tool_call_payload(int n_calls)
+{
+    std::string text = "I will look that up.\n";
+    for (int i = 0; i < n_calls; i++) {
+        text += "<tool_call>\n{\"name\": \"search\", \"arguments\": "
+                "{\"query\": \"benchmark query " +
+                std::to_string(i) +
+                "\", \"limit\": 10, \"filters\": {\"lang\": \"en\", "
+                "\"sources\": [\"web\", \"news\", \"docs\"]}}}\n"
+                "</tool_call>\n";
+    }
+    return text;
+}
+
+void
+bench_chat_parse(BenchRunner& runner)
+{
+    common_chat_syntax syntax;
+    syntax.format = COMMON_CHAT_FORMAT_HERMES_2_PRO;
+    syntax.parse_tool_calls = true;
+
+    for (int n_calls : { 1, 8 }) {
+        const std::string payload = tool_call_payload(n_calls);
+        runner.run("chat_parse/tool_calls:" + std::to_string(n_calls), [&] {
+            auto msg = common_chat_parse(payload, false, syntax);
+            return static_cast<int64_t>(msg.tool_calls.size());
+        });
+    }
+
+    // What ToolCallStream does on every closing brace while streaming
+    const std::string partial = tool_call_payload(8);
+    runner.run("chat_parse/partial", [&] {
+        auto msg = common_chat_parse(
+          partial.substr(0, partial.size() * 3 / 4), true, syntax);
+        return static_cast<int64_t>(msg.tool_calls.size());
+    });
+}
+
+// --- Prefix matching ------------------------------------------------------
+
+std::vector<llama_token>
+synthetic_tokens(size_t n, uint32_t seed)
+{
+    std::vector<llama_token> tokens(n);
+    for (size_t i = 0; i < n; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        tokens[i] = static_cast<llama_token>(seed % 32000);
+    }
+    return tokens;
+}
+
+void
+bench_prefix_match(BenchRunner& runner)
+{
+    // A shared system prompt followed by per-conversation history
+    const size_t n_prefix = 1024;
+    const size_t n_tokens = 8192;
+    const std::vector<llama_token> prefix = synthetic_tokens(n_prefix, 1);
+
+    std::vector<std::vector<llama_token>> conversations;
+    for (uint32_t c = 0; c < 32; c++) {
+        auto tokens = prefix;
+        auto history = synthetic_tokens(n_tokens - n_prefix, c + 2);
+        tokens.insert(tokens.end(), history.begin(), history.end());
+        conversations.push_back(std::move(tokens));
+    }
+
+    // The linear scan Model runs against its processed tokens each turn
+    const auto& processed = conversations[0];
+    auto prompt = processed;
+    prompt.push_back(1);
+    runner.run("prefix_match/processed_tokens:8192", [&] {
+        size_t common = 0;
+        while (common < processed.size() && common < prompt.size() &&
+               processed[common] == prompt[common]) {
+            common++;
+        }
+        return static_cast<int64_t>(common);
+    });
+
+    agent_cpp::PromptCache cache(conversations.size() * 1024);
+    const std::vector<uint8_t> state(16);
+    for (const auto& tokens : conversations) {
+        cache.insert(tokens, state);
+    }
+    const auto& query = conversations[conversations.size() / 2];
+    runner.run("prefix_match/prompt_cache:32x8192", [&] {
+        auto match = cache.lookup(query);
+        return static_cast<int64_t>(match.n_matched);
+    });
+}
+
+// --- Agent tool dispatch --------------------------------------------------
+
+class EchoTool : public agent_cpp::Tool
+{
+  public:
+    common_chat_tool get_definition() const override
+    {
+        return { "echo", "Echo the text back", R"({"type": "object"})" };
+    }
+
+    std::string execute(const agent_cpp::json& arguments) override
+    {
+        return arguments.dump();
+    }
+
+    std::string get_name() const override { return "echo"; }
+};
+
+// Answers with n_calls tool calls, then with text once tool results are in,
+// so run_loop's own overhead is all that is measured
+class ScriptedModel : public agent_cpp::IModel
+{
+  public:
+    explicit ScriptedModel(int n_calls)
+      : n_calls_(n_calls)
+    {
+    }
+
+    common_chat_msg generate(const std::vector<common_chat_msg>& messages,
+                             const std::vector<common_chat_tool>& /*tools*/,
+                             const agent_cpp::ResponseCallback& /*callback*/,
+                             const agent_cpp::GenerateOptions& /*options*/)
+      override
+    {
+        common_chat_msg msg;
+        msg.role = "assistant";
+        if (messages.back().role == "tool") {
+            msg.content = "done";
+            return msg;
+        }
+        for (int i = 0; i < n_calls_; i++) {
+            msg.tool_calls.push_back({ "echo",
+                                       R"({"text": "hello"})",
+                                       "call_" + std::to_string(i) });
+        }
+        return msg;
+    }
+
+  private:
+    int n_calls_;
+};
+
+void
+bench_agent(BenchRunner& runner)
+{
+    const int n_calls = 4;
+    for (bool parallel : { false, true }) {
+        std::vector<std::unique_ptr<agent_cpp::Tool>> tools;
+        tools.push_back(std::make_unique<EchoTool>());
+        agent_cpp::Agent agent(std::make_shared<ScriptedModel>(n_calls),
+                               std::move(tools));
+        if (parallel) {
+            agent.set_tool_executor(
+              std::make_shared<agent_cpp::ToolExecutor>(n_calls));
+        }
+
+        common_chat_msg user;
+        user.role = "user";
+        user.content = "Echo something";
+        const std::vector<common_chat_msg> base = { user };
+
+        runner.run(std::string("agent/run_loop:") +
+                     (parallel ? "parallel" : "sequential"),
+                   [&] {
+                       auto messages = base;
+                       agent.run_loop(messages);
+                       return static_cast<int64_t>(n_calls);
+                   });
+    }
+}
+
+// --- MCP ------------------------------------------------------------------
+
+#ifdef AGENT_BENCH_MCP
+// Minimal streamable-HTTP MCP server answering every request as SSE
+class StubMcpServer
+{
+  public:
+    StubMcpServer()
+    {
+        const std::string text(4096, 'x');
+        server_.Post("/mcp", [text](const httplib::Request& req,
+                                    httplib::Response& res) {
+            json request = json::parse(req.body);
+            if (!request.contains("id")) {
+                res.status = 202; // Notification
+                return;
+            }
+
+            json result = json::object();
+            const std::string method = request["method"];
+            if (method == "initialize") {
+                result = { { "protocolVersion", "2025-06-18" },
+                           { "capabilities", { { "tools", json::object() } } },
+                           { "serverInfo", { { "name", "stub" } } } };
+            } else if (method == "tools/call") {
+                result = { { "content",
+                             { { { "type", "text" }, { "text", text } } } },
+                           { "isError", false } };
+            }
+            json response = { { "jsonrpc", "2.0" },
+                              { "id", request["id"] },
+                              { "result", result } };
+            res.set_content("event: message\ndata: " + response.dump() +
+                              "\n\n",
+                            "text/event-stream");
+        });
+        port_ = server_.bind_to_any_port("127.0.0.1");
+        thread_ = std::thread([this] { server_.listen_after_bind(); });
+        server_.wait_until_ready();
+    }
+
+    ~StubMcpServer()
+    {
+        server_.stop();
+        thread_.join();
+    }
+
+    StubMcpServer(const StubMcpServer&) = delete;
+    StubMcpServer& operator=(const StubMcpServer&) = delete;
+
+    [[nodiscard]] std::string url() const
+    {
+        return "http://127.0.0.1:" + std::to_string(port_) + "/mcp";
+    }
+
+  private:
+    httplib::Server server_;
+    int port_ = 0;
+    std::thread thread_;
+};
+
+void
+bench_mcp(BenchRunner& runner)
+{
+    if (!runner.enabled("mcp/")) {
+        return;
+    }
+
+    StubMcpServer server;
+    auto client = agent_cpp::MCPClient::create(server.url());
+    if (!client->initialize()) {
+        fprintf(stderr, "skipping mcp/: stub server did not initialize\n");
+        return;
+    }
+
+    const agent_cpp::json arguments = { { "text", "hello" } };
+    runner.run("mcp/call_tool_sse:4096", [&] {
+        auto result = client->call_tool("echo", arguments);
+        return static_cast<int64_t>(result.content.at(0).text.size());
+    });
+}
+#endif
+
+// --- Model ----------------------------------------------------------------
+
+std::vector<common_chat_msg>
+sample_conversation(int n_turns)
+{
+    std::vector<common_chat_msg> messages;
+    common_chat_msg system;
+    system.role = "system";
+    system.content = "You are a helpful assistant with access to tools.";
+    messages.push_back(system);
+
+    for (int i = 0; i < n_turns; i++) {
+        common_chat_msg user;
+        user.role = "user";
+        user.content = "Question " + std::to_string(i) +
+                       ": what is the weather like in Paris today?";
+        messages.push_back(user);
+
+        common_chat_msg assistant;
+        assistant.role = "assistant";
+        assistant.content = "It is sunny in Paris, with a high of 24 degrees "
+                            "and a light breeze from the west.";
+        messages.push_back(assistant);
+    }
+    return messages;
+}
+
+std::vector<common_chat_tool>
+sample_tools()
+{
+    std::vector<common_chat_tool> tools;
+    for (const char* name : { "search", "weather", "calculator", "shell" }) {
+        tools.push_back(
+          { name,
+            std::string("Run the ") + name + " tool",
+            R"({"type": "object", "properties": {"input": {"type": "string"}},)"
+            R"( "required": ["input"]})" });
+    }
+    return tools;
+}
+
+// Thrown from the response callback to end generate_from_tokens once enough
+// tokens were sampled; the Model's KV cache stays consistent
+struct StopGeneration
+{
+};
+
+// Run Model::generate_from_tokens on prompt until n_gen tokens are sampled
+void
+generate_tokens(agent_cpp::Model& model,
+                const std::vector<llama_token>& prompt,
+                int n_gen)
+{
+    const size_t n_stop = prompt.size() + n_gen;
+    try {
+        model.generate_from_tokens(prompt, [&](const std::string&) {
+            // The sampled token is not in the KV cache yet
+            if (model.get_processed_tokens().size() + 1 >= n_stop) {
+                throw StopGeneration{};
+            }
+        });
+    } catch (const StopGeneration&) {
+    }
+}
+
+// A copy of tokens with the token at index changed, so that alternating
+// between the two makes the Model discard its KV cache from that index on
+std::vector<llama_token>
+with_token_changed(std::vector<llama_token> tokens,
+                   size_t index,
+                   const llama_vocab* vocab)
+{
+    tokens[index] = (tokens[index] + 1) % llama_vocab_n_tokens(vocab);
+    return tokens;
+}
+
+void
+bench_model(BenchRunner& runner, const BenchOptions& options)
+{
+    if (options.model_path.empty()) {
+        fprintf(stderr, "skipping model benchmarks (no -m)\n");
+        return;
+    }
+
+    auto weights = agent_cpp::ModelWeights::create(options.model_path);
+    const llama_vocab* vocab = weights->get_vocab();
+
+    agent_cpp::ModelConfig config;
+    config.n_ctx = options.n_prompt + options.n_gen + 256;
+    // Never stop early: every iteration samples the same number of tokens
+    for (llama_token t = 0; t < llama_vocab_n_tokens(vocab); t++) {
+        if (llama_vocab_is_eog(vocab, t)) {
+            config.logit_bias.push_back({ t, -INFINITY });
+        }
+    }
+    auto model = agent_cpp::Model::create_with_weights(weights, config);
+
+    const auto messages = sample_conversation(16);
+    const auto tools = sample_tools();
+    runner.run("prompt/render_tokenize", [&] {
+        common_chat_templates_inputs inputs;
+        inputs.messages = messages;
+        inputs.tools = tools;
+        inputs.add_generation_prompt = true;
+        auto params =
+          common_chat_templates_apply(model->get_templates(), inputs);
+        return static_cast<int64_t>(model->tokenize(params.prompt).size());
+    });
+
+    // A prompt of exactly n_prompt tokens from repeated conversation text
+    std::vector<llama_token> prompt;
+    const auto text_tokens = model->tokenize(messages[2].content);
+    while (prompt.size() < static_cast<size_t>(options.n_prompt)) {
+        prompt.insert(prompt.end(), text_tokens.begin(), text_tokens.end());
+    }
+    prompt.resize(options.n_prompt);
+
+    // Prompts differing in their first token: each call prefills all of it
+    // through the Model's reusable batch, then samples one token
+    const std::vector<llama_token> prefill_prompts[] = {
+        prompt, with_token_changed(prompt, 0, vocab)
+    };
+    for (int n_batch : { 128, 512, 2048 }) {
+        config.n_batch = n_batch;
+        auto batch_model =
+          agent_cpp::Model::create_with_weights(weights, config);
+        size_t iteration = 0;
+        runner.run("prefill/n_batch:" + std::to_string(n_batch), [&] {
+            generate_tokens(*batch_model, prefill_prompts[iteration++ % 2], 1);
+            return static_cast<int64_t>(prompt.size());
+        });
+    }
+
+    // Prompts differing in their last token: each call prefills one token,
+    // then samples, detokenizes and streams n_gen tokens
+    const std::vector<llama_token> decode_prompts[] = {
+        prompt, with_token_changed(prompt, prompt.size() - 1, vocab)
+    };
+    size_t iteration = 0;
+    runner.run("decode/tokens:" + std::to_string(options.n_gen), [&] {
+        generate_tokens(*model, decode_prompts[iteration++ % 2], options.n_gen);
+        return static_cast<int64_t>(options.n_gen);
+    });
+}
+
+// --- Command line ---------------------------------------------------------
+
+void
+print_usage(int /*unused*/, char** argv)
+{
+    printf("\nexample usage:\n");
+    printf("\n    %s -m model.gguf -o results.json\n", argv[0]);
+    printf("\n");
+    printf("options:\n");
+    printf("  -m <path>         GGUF model for the prompt, prefill and "
+           "decode benchmarks\n");
+    printf("  -o <path>         Write JSON results here (default: stdout)\n");
+    printf("  --filter <text>   Only run benchmarks whose name contains "
+           "text\n");
+    printf("  --min-time <s>    Seconds to run each benchmark (default: "
+           "0.5)\n");
+    printf("  -p <number>       Prompt tokens for prefill (default: 2048)\n");
+    printf("  -n <number>       Tokens to decode (default: 128)\n");
+    printf("\n");
+}
+
+// Returns false if the arguments are invalid
+bool
+parse_args(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i < argc; i++) {
+        auto next = [&]() -> const char* {
+            return i + 1 < argc ? argv[++i] : nullptr;
+        };
+        const char* value = nullptr;
+
+        if (strcmp(argv[i], "-m") == 0 && (value = next())) {
+            options.model_path = value;
+        } else if (strcmp(argv[i], "-o") == 0 && (value = next())) {
+            options.output_path = value;
+        } else if (strcmp(argv[i], "--filter") == 0 && (value = next())) {
+            options.filter = value;
+        } else if (strcmp(argv[i], "--min-time") == 0 && (value = next())) {
+            options.min_time = std::stod(value);
+        } else if (strcmp(argv[i], "-p") == 0 && (value = next())) {
+            options.n_prompt = std::stoi(value);
+        } else if (strcmp(argv[i], "-n") == 0 && (value = next())) {
+            options.n_gen = std::stoi(value);
+        } else {
+            return false;
+        }
+    }
+    return options.n_prompt > 0 && options.n_gen > 0;
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char** argv)
+{
+    BenchOptions options;
+    try {
+        if (!parse_args(argc, argv, options)) {
+            print_usage(argc, argv);
+            return 1;
+        }
+    } catch (const std::exception&) {
+        print_usage(argc, argv);
+        return 1;
+    }
+
+    // Keep llama.cpp's logging out of the results
+    llama_log_set([](ggml_log_level, const char*, void*) {}, nullptr);
+
+    BenchRunner runner(options);
+    try {
+        bench_chat_parse(runner);
+        bench_prefix_match(runner);
+        bench_agent(runner);
+#ifdef AGENT_BENCH_MCP
+        bench_mcp(runner);
+#endif
+        bench_model(runner, options);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+
+    const std::string output = to_json(options, runner.results()).dump(2);
+    if (options.output_path.empty()) {
+        std::cout << output << std::endl;
+    } else {
+        std::ofstream file(options.output_path);
+        file << output << std::endl;
+        if (!file) {
+            fprintf(stderr, "error: cannot write %s\n",
+                    options.output_path.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -149,6 +149,25 @@ class OpenTelemetryCallback : public agent_cpp::Callback
         llm_span->SetAttribute("gen_ai.request.model", model_name);
     }
 
+    void on_llm_stats(const agent_cpp::GenerationStats& stats) override
+    {
+        if (llm_span) {
+            llm_span->SetAttribute("gen_ai.usage.input_tokens",
+                                   stats.n_prompt_tokens);
+            llm_span->SetAttribute("gen_ai.usage.output_tokens",
+                                   stats.n_generated_tokens);
+            // Not part of the semantic conventions
+            llm_span->SetAttribute("agent_cpp.usage.cached_tokens",
+                                   stats.n_cached_tokens);
+            llm_span->SetAttribute("agent_cpp.prefill_ms", stats.prefill_ms);
+            llm_span->SetAttribute("agent_cpp.decode_ms", stats.decode_ms);
+            llm_span->SetAttribute("agent_cpp.time_to_first_token_ms",
+                                   stats.ttft_ms);
+            llm_span->SetAttribute("agent_cpp.decode_tokens_per_second",
+                                   stats.decode_tokens_per_second());
+        }
+    }
+
     void after_llm_call(common_chat_msg& parsed_msg) override
     {
         if (llm_span) {
@@ -0,0 +1,648 @@
+#include "agent.h"
+#include "cancellation.h"
+#include "error.h"
+#include "httplib.h"
+#include "inference_engine.h"
+#include "model.h"
+#include "tool_executor.h"
+
+#ifdef AGENT_SERVER_MCP
+#include "mcp/mcp_client.h"
+#endif
+
+#ifdef AGENT_SERVER_METRICS
+#include "metrics/metrics.h"
+#include "metrics/metrics_callback.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+namespace {
+
+constexpr int DEFAULT_PORT = 8080;
+constexpr int DEFAULT_SESSIONS = 4;
+
+// One agent bound to one sequence of the shared context
+struct ServerSession
+{
+    std::unique_ptr<agent_cpp::Agent> agent;
+    // Conversation served last, with the agent's own tool-call turns and
+    // tool results; used to route follow-ups back to this session
+    std::vector<common_chat_msg> history;
+    uint64_t last_used = 0;
+    bool busy = false;
+};
+
+bool
+same_message(const common_chat_msg& a, const common_chat_msg& b)
+{
+    if (a.role != b.role || a.content != b.content ||
+        a.tool_call_id != b.tool_call_id ||
+        a.tool_calls.size() != b.tool_calls.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.tool_calls.size(); i++) {
+        if (a.tool_calls[i].name != b.tool_calls[i].name ||
+            a.tool_calls[i].arguments != b.tool_calls[i].arguments) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Number of leading request messages that continue a session's history.
+// Clients only get the final reply, so history turns with tool calls or tool
+// results are skipped when the request does not repeat them
+size_t
+shared_messages(const std::vector<common_chat_msg>& history,
+                const std::vector<common_chat_msg>& messages)
+{
+    size_t h = 0;
+    size_t n = 0;
+    while (h < history.size() && n < messages.size()) {
+        if (same_message(history[h], messages[n])) {
+            h++;
+            n++;
+        } else if (history[h].role == "tool" ||
+                   !history[h].tool_calls.empty()) {
+            h++;
+        } else {
+            break;
+        }
+    }
+    return n;
+}
+
+// Hands out idle sessions, preferring the one that served the start of the
+// same conversation so its KV cache is reused
+class SessionPool
+{
+  public:
+    explicit SessionPool(std::vector<std::unique_ptr<ServerSession>> sessions)
+      : sessions_(std::move(sessions))
+    {
+    }
+
+    // Blocks until a session is idle
+    ServerSession* acquire(const std::vector<common_chat_msg>& messages)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] {
+            for (const auto& session : sessions_) {
+                if (!session->busy) {
+                    return true;
+                }
+            }
+            return false;
+        });
+
+        ServerSession* best = nullptr;
+        size_t best_shared = 0;
+        for (const auto& session : sessions_) {
+            if (session->busy) {
+                continue;
+            }
+            const size_t shared = shared_messages(session->history, messages);
+            // Longest shared conversation wins; otherwise take the least
+            // recently used session and leave hot ones to their owners
+            if (best == nullptr || shared > best_shared ||
+                (shared == best_shared &&
+                 session->last_used < best->last_used)) {
+                best = session.get();
+                best_shared = shared;
+            }
+        }
+
+        best->busy = true;
+        return best;
+    }
+
+    void release(ServerSession* session, std::vector<common_chat_msg> history)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            session->history = std::move(history);
+            session->last_used = ++clock_;
+            session->busy = false;
+        }
+        cv_.notify_one();
+    }
+
+  private:
+    std::vector<std::unique_ptr<ServerSession>> sessions_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    uint64_t clock_ = 0;
+};
+
+// Releases the session when the request finishes or throws
+class SessionLease
+{
+  public:
+    SessionLease(SessionPool& pool,
+                 const std::vector<common_chat_msg>& messages)
+      : pool_(pool)
+      , session_(pool.acquire(messages))
+    {
+    }
+
+    ~SessionLease() { pool_.release(session_, std::move(history_)); }
+
+    SessionLease(const SessionLease&) = delete;
+    SessionLease& operator=(const SessionLease&) = delete;
+
+    agent_cpp::Agent& agent() { return *session_->agent; }
+
+    // Record the conversation served, once the request succeeded
+    void set_history(std::vector<common_chat_msg> history)
+    {
+        history_ = std::move(history);
+    }
+
+  private:
+    SessionPool& pool_;
+    ServerSession* session_;
+    std::vector<common_chat_msg> history_;
+};
+
+common_chat_msg
+from_openai_message(const json& m)
+{
+    common_chat_msg msg;
+    msg.role = m.value("role", "");
+
+    const json& content = m.contains("content") ? m["content"] : json();
+    if (content.is_string()) {
+        msg.content = content.get<std::string>();
+    } else if (content.is_array()) {
+        for (const auto& part : content) {
+            if (part.value("type", "") == "text") {
+                msg.content += part.value("text", "");
+            }
+        }
+    }
+
+    if (m.contains("tool_calls") && m["tool_calls"].is_array()) {
+        for (const auto& tc : m["tool_calls"]) {
+            common_chat_tool_call call;
+            call.id = tc.value("id", "");
+            if (tc.contains("function")) {
+                call.name = tc["function"].value("name", "");
+                call.arguments = tc["function"].value("arguments", "");
+            }
+            msg.tool_calls.push_back(std::move(call));
+        }
+    }
+
+    msg.tool_call_id = m.value("tool_call_id", "");
+    msg.tool_name = m.value("name", "");
+    return msg;
+}
+
+llama_token
+parse_token_id(const std::string& text, int n_vocab)
+{
+    size_t end = 0;
+    int token = -1;
+    try {
+        token = std::stoi(text, &end);
+    } catch (const std::exception&) {
+        end = 0;
+    }
+    if (end == 0 || end != text.size() || token < 0 || token >= n_vocab) {
+        throw std::invalid_argument("logit_bias: invalid token id " + text);
+    }
+    return token;
+}
+
+// Sampling settings of a chat completion request, applied over defaults.
+// Returns nullopt if the request sets none. Fields the server cannot honor
+// throw std::invalid_argument rather than being ignored
+std::optional<agent_cpp::SamplingParams>
+sampling_from_request(const json& body,
+                      const agent_cpp::SamplingParams& defaults,
+                      int n_vocab)
+{
+    agent_cpp::SamplingParams sampling = defaults;
+    bool is_set = false;
+    for (auto it = body.begin(); it != body.end(); ++it) {
+        const std::string& key = it.key();
+        const json& value = it.value();
+        if (value.is_null() || key == "messages" || key == "model" ||
+            key == "stream" || key == "stream_options" || key == "user") {
+            continue;
+        }
+        if (key == "n") {
+            if (value.get<int>() != 1) {
+                throw std::invalid_argument("n: only 1 is supported");
+            }
+            continue;
+        }
+
+        if (key == "temperature") {
+            sampling.temp = value.get<float>();
+        } else if (key == "top_p") {
+            sampling.top_p = value.get<float>();
+        } else if (key == "top_k") {
+            sampling.top_k = value.get<int>();
+        } else if (key == "min_p") {
+            sampling.min_p = value.get<float>();
+        } else if (key == "seed") {
+            sampling.seed = value.get<uint32_t>();
+        } else if (key == "repetition_penalty") {
+            sampling.penalty_repeat = value.get<float>();
+        } else if (key == "frequency_penalty") {
+            sampling.penalty_freq = value.get<float>();
+        } else if (key == "presence_penalty") {
+            sampling.penalty_present = value.get<float>();
+        } else if (key == "logit_bias") {
+            sampling.logit_bias.clear();
+            for (auto bias = value.begin(); bias != value.end(); ++bias) {
+                sampling.logit_bias.push_back(
+                  { parse_token_id(bias.key(), n_vocab),
+                    bias.value().get<float>() });
+            }
+        } else {
+            throw std::invalid_argument(key + ": not supported");
+        }
+        is_set = true;
+    }
+
+    if (!is_set) {
+        return std::nullopt;
+    }
+    return sampling;
+}
+
+json
+error_body(const std::string& message, const std::string& type)
+{
+    return { { "error", { { "message", message }, { "type", type } } } };
+}
+
+json
+completion_chunk(const std::string& id,
+                 const std::string& model_name,
+                 const json& delta,
+                 const json& finish_reason)
+{
+    return { { "id", id },
+             { "object", "chat.completion.chunk" },
+             { "created", static_cast<int64_t>(std::time(nullptr)) },
+             { "model", model_name },
+             { "choices",
+               json::array({ { { "index", 0 },
+                               { "delta", delta },
+                               { "finish_reason", finish_reason } } }) } };
+}
+
+bool
+write_event(httplib::DataSink& sink, const std::string& data)
+{
+    const std::string event = "data: " + data + "\n\n";
+    return sink.write(event.data(), event.size());
+}
+
+struct ServerOptions
+{
+    std::string model_path;
+    std::string host = "127.0.0.1";
+    int port = DEFAULT_PORT;
+    int n_sessions = DEFAULT_SESSIONS;
+    int n_ctx = agent_cpp::ModelConfig{}.n_ctx;
+    std::string instructions;
+    std::vector<std::string> mcp_urls;
+};
+
+// The conversation run_loop served, as routing history: the agent's own
+// system message goes, since --system strips it from requests as well
+std::vector<common_chat_msg>
+served_history(std::vector<common_chat_msg> conversation,
+               const ServerOptions& options)
+{
+    if (!options.instructions.empty() && !conversation.empty()) {
+        conversation.erase(conversation.begin());
+    }
+    return conversation;
+}
+
+void
+print_usage(int /*unused*/, char** argv)
+{
+    printf("\nexample usage:\n");
+    printf("\n    %s -m model.gguf --port 8080\n", argv[0]);
+    printf("\n");
+    printf("options:\n");
+    printf("  -m <path>         Path to the GGUF model file (required)\n");
+    printf("  --host <host>     Address to listen on (default: 127.0.0.1)\n");
+    printf("  --port <port>     Port to listen on (default: %d)\n",
+           DEFAULT_PORT);
+    printf("  -s <number>       Concurrent sessions (default: %d)\n",
+           DEFAULT_SESSIONS);
+    printf("  -c <number>       Context size per session (default: %d)\n",
+           agent_cpp::ModelConfig{}.n_ctx);
+    printf("  --system <text>   System instructions for every agent\n");
+#ifdef AGENT_SERVER_MCP
+    printf("  -u <url>          MCP server whose tools the agents can use "
+           "(repeatable)\n");
+#endif
+    printf("\n");
+}
+
+// Returns false if the arguments are invalid
+bool
+parse_args(int argc, char** argv, ServerOptions& options)
+{
+    for (int i = 1; i < argc; i++) {
+        auto next = [&]() -> const char* {
+            return i + 1 < argc ? argv[++i] : nullptr;
+        };
+        const char* value = nullptr;
+
+        if (strcmp(argv[i], "-m") == 0 && (value = next())) {
+            options.model_path = value;
+        } else if (strcmp(argv[i], "--host") == 0 && (value = next())) {
+            options.host = value;
+        } else if (strcmp(argv[i], "--port") == 0 && (value = next())) {
+            options.port = std::stoi(value);
+        } else if (strcmp(argv[i], "-s") == 0 && (value = next())) {
+            options.n_sessions = std::stoi(value);
+        } else if (strcmp(argv[i], "-c") == 0 && (value = next())) {
+            options.n_ctx = std::stoi(value);
+        } else if (strcmp(argv[i], "--system") == 0 && (value = next())) {
+            options.instructions = value;
+#ifdef AGENT_SERVER_MCP
+        } else if (strcmp(argv[i], "-u") == 0 && (value = next())) {
+            options.mcp_urls.emplace_back(value);
+#endif
+        } else {
+            return false;
+        }
+    }
+    return !options.model_path.empty() && options.n_sessions > 0;
+}
+
+} // anonymous namespace
+
+int
+main(int argc, char** argv)
+{
+    ServerOptions options;
+    try {
+        if (!parse_args(argc, argv, options)) {
+            print_usage(argc, argv);
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "error: %s\n", e.what());
+        print_usage(argc, argv);
+        return 1;
+    }
+
+    const std::string model_name =
+      std::filesystem::path(options.model_path).filename().string();
+
+    std::shared_ptr<agent_cpp::InferenceEngine> engine;
+    std::unique_ptr<SessionPool> pool;
+#ifdef AGENT_SERVER_MCP
+    std::vector<std::shared_ptr<agent_cpp::MCPClient>> mcp_clients;
+#endif
+#ifdef AGENT_SERVER_METRICS
+    auto metrics = std::make_shared<agent_cpp::MetricsRegistry>();
+#endif
+
+    try {
+        printf("Loading model...\n");
+        auto weights = agent_cpp::ModelWeights::create(options.model_path);
+
+        agent_cpp::ModelConfig model_config;
+        model_config.n_ctx = options.n_ctx;
+        engine = agent_cpp::InferenceEngine::create(
+          weights, model_config, options.n_sessions);
+
+#ifdef AGENT_SERVER_MCP
+        for (const auto& url : options.mcp_urls) {
+            printf("Connecting to MCP server: %s\n", url.c_str());
+            agent_cpp::MCPClientConfig mcp_config;
+#ifdef AGENT_SERVER_METRICS
+            mcp_config.on_request =
+              agent_cpp::make_mcp_request_observer(metrics);
+#endif
+            auto client = agent_cpp::MCPClient::create(url, mcp_config);
+            if (!client->initialize("agent-server", "0.1.0")) {
+                fprintf(
+                  stderr, "error: failed to initialize %s\n", url.c_str());
+                return 1;
+            }
+            mcp_clients.push_back(std::move(client));
+        }
+#endif
+
+        // Tools are I/O-bound here, so run a message's tool calls together
+        auto tool_executor = std::make_shared<agent_cpp::ToolExecutor>();
+
+        std::vector<std::unique_ptr<ServerSession>> sessions;
+        for (int i = 0; i < options.n_sessions; i++) {
+            std::vector<std::unique_ptr<agent_cpp::Tool>> tools;
+#ifdef AGENT_SERVER_MCP
+            for (const auto& client : mcp_clients) {
+                for (auto& tool : client->get_tools()) {
+                    tools.push_back(std::move(tool));
+                }
+            }
+#endif
+            std::vector<std::unique_ptr<agent_cpp::Callback>> callbacks;
+#ifdef AGENT_SERVER_METRICS
+            callbacks.push_back(
+              std::make_unique<agent_cpp::MetricsCallback>(metrics));
+#endif
+            auto session = std::make_unique<ServerSession>();
+            session->agent =
+              std::make_unique<agent_cpp::Agent>(engine->create_session(),
+                                                 std::move(tools),
+                                                 std::move(callbacks),
+                                                 options.instructions);
+            session->agent->set_tool_executor(tool_executor);
+            sessions.push_back(std::move(session));
+        }
+
+        // Every agent has the same system prompt and tools: prefill it once
+        sessions.front()->agent->share_prompt_prefix();
+        pool = std::make_unique<SessionPool>(std::move(sessions));
+    } catch (const std::exception& e) {
+        fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+
+    std::atomic<uint64_t> next_id{ 0 };
+    httplib::Server server;
+
+    server.Get("/health", [](const httplib::Request&, httplib::Response& res) {
+        res.set_content(R"({"status":"ok"})", "application/json");
+    });
+
+#ifdef AGENT_SERVER_METRICS
+    server.Get("/metrics",
+               [&metrics](const httplib::Request&, httplib::Response& res) {
+                   res.set_content(metrics->render(),
+                                   "text/plain; version=0.0.4");
+               });
+#endif
+
+    server.Get("/v1/models",
+               [&model_name](const httplib::Request&, httplib::Response& res) {
+                   json body = {
+                       { "object", "list" },
+                       { "data",
+                         json::array({ { { "id", model_name },
+                                         { "object", "model" },
+                                         { "owned_by", "agent.cpp" } } }) }
+                   };
+                   res.set_content(body.dump(), "application/json");
+               });
+
+    server.Post(
+      "/v1/chat/completions",
+      [&](const httplib::Request& req, httplib::Response& res) {
+          json body;
+          std::vector<common_chat_msg> messages;
+          std::optional<agent_cpp::SamplingParams> sampling;
+          try {
+              body = json::parse(req.body);
+              if (!body.is_object()) {
+                  throw std::invalid_argument("body must be a JSON object");
+              }
+              for (const auto& m : body.at("messages")) {
+                  messages.push_back(from_openai_message(m));
+              }
+              sampling = sampling_from_request(
+                body,
+                engine->get_config(),
+                llama_vocab_n_tokens(engine->get_weights()->get_vocab()));
+          } catch (const std::exception& e) {
+              res.status = 400;
+              res.set_content(
+                error_body(e.what(), "invalid_request_error").dump(),
+                "application/json");
+              return;
+          }
+
+          // --system replaces the request's leading system messages: chat
+          // templates expect at most one, and the agent puts its own first
+          if (!options.instructions.empty()) {
+              auto first = std::find_if(
+                messages.begin(), messages.end(), [](const auto& m) {
+                    return m.role != "system";
+                });
+              messages.erase(messages.begin(), first);
+          }
+
+          const std::string id = "chatcmpl-" + std::to_string(++next_id);
+
+          if (!body.value("stream", false)) {
+              try {
+                  SessionLease lease(*pool, messages);
+                  lease.agent().set_sampling(sampling);
+                  std::vector<common_chat_msg> conversation = messages;
+                  std::string reply = lease.agent().run_loop(conversation);
+                  lease.set_history(
+                    served_history(std::move(conversation), options));
+
+                  json out = {
+                      { "id", id },
+                      { "object", "chat.completion" },
+                      { "created", static_cast<int64_t>(std::time(nullptr)) },
+                      { "model", model_name },
+                      { "choices",
+                        json::array({ { { "index", 0 },
+                                        { "message",
+                                          { { "role", "assistant" },
+                                            { "content", reply } } },
+                                        { "finish_reason", "stop" } } }) }
+                  };
+                  res.set_content(out.dump(), "application/json");
+              } catch (const std::exception& e) {
+                  res.status = 500;
+                  res.set_content(error_body(e.what(), "server_error").dump(),
+                                  "application/json");
+              }
+              return;
+          }
+
+          // Streaming: the agent runs inside the content provider, on this
+          // connection's worker thread, and writes each token as an event
+          res.set_header("Cache-Control", "no-cache");
+          res.set_chunked_content_provider(
+            "text/event-stream",
+            [&pool, &model_name, &options, id, messages, sampling](
+              size_t /*offset*/, httplib::DataSink& sink) {
+                auto cancel = std::make_shared<agent_cpp::CancellationToken>();
+                auto send = [&](const json& data) {
+                    // A failed write means the client went away
+                    if (!write_event(sink, data.dump())) {
+                        cancel->cancel();
+                    }
+                };
+
+                try {
+                    SessionLease lease(*pool, messages);
+                    lease.agent().set_sampling(sampling);
+                    send(completion_chunk(
+                      id, model_name, { { "role", "assistant" } }, nullptr));
+
+                    std::vector<common_chat_msg> conversation = messages;
+                    lease.agent().run_loop(
+                      conversation,
+                      [&](const std::string& chunk) {
+                          send(completion_chunk(
+                            id, model_name, { { "content", chunk } }, nullptr));
+                      },
+                      cancel);
+
+                    send(completion_chunk(
+                      id, model_name, json::object(), "stop"));
+
+                    lease.set_history(
+                      served_history(std::move(conversation), options));
+                } catch (const agent_cpp::CancelledError&) {
+                    sink.done();
+                    return true;
+                } catch (const std::exception& e) {
+                    write_event(sink,
+                                error_body(e.what(), "server_error").dump());
+                }
+
+                write_event(sink, "[DONE]");
+                sink.done();
+                return true;
+            });
+      });
+
+    printf("agent-server listening on http://%s:%d (%d sessions)\n",
+           options.host.c_str(),
+           options.port,
+           options.n_sessions);
+    if (!server.listen(options.host, options.port)) {
+        fprintf(stderr,
+                "error: could not listen on %s:%d\n",
+                options.host.c_str(),
+                options.port);
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,13 +1,46 @@
 #include "agent.h"
 #include "error.h"
 #include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <filesystem>
+#include <future>
 
 namespace agent_cpp {
 
 using json = nlohmann::json;
 
+namespace {
+
+// Waits for every submitted tool task when it goes out of scope, so that no
+// tool keeps running (and using the Agent) once the loop has unwound
+template<typename PendingCalls>
+class ToolTasksGuard
+{
+  public:
+    explicit ToolTasksGuard(PendingCalls& calls)
+      : calls_(calls)
+    {
+    }
+
+    ~ToolTasksGuard()
+    {
+        for (auto& call : calls_) {
+            if (call.future.valid()) {
+                call.future.wait();
+            }
+        }
+    }
+
+    ToolTasksGuard(const ToolTasksGuard&) = delete;
+    ToolTasksGuard& operator=(const ToolTasksGuard&) = delete;
+
+  private:
+    PendingCalls& calls_;
+};
+
+} // anonymous namespace
+
 Agent::Agent(std::shared_ptr<IModel> model,
              std::vector<std::unique_ptr<Tool>> tools,
              std::vector<std::unique_ptr<Callback>> callbacks,
@@ -17,6 +50,25 @@ Agent::Agent(std::shared_ptr<IModel> model,
   , callbacks(std::move(callbacks))
   , instructions(instructions)
 {
+    tool_index.reserve(this->tools.size());
+    tool_definitions.reserve(this->tools.size());
+    for (const auto& tool : this->tools) {
+        index_tool(tool.get());
+    }
+}
+
+void
+Agent::index_tool(Tool* tool)
+{
+    tool_index.emplace(tool->get_name(), tool);
+    tool_definitions.push_back(tool->get_definition());
+}
+
+void
+Agent::add_tool(std::unique_ptr<Tool> tool)
+{
+    index_tool(tool.get());
+    tools.push_back(std::move(tool));
 }
 
 void
@@ -36,20 +88,10 @@ Agent::ensure_system_message(std::vector<common_chat_msg>& messages)
     }
 }
 
-std::vector<common_chat_tool>
-Agent::get_tool_definitions() const
-{
-    std::vector<common_chat_tool> tool_definitions;
-    tool_definitions.reserve(tools.size());
-    for (const auto& tool : tools) {
-        tool_definitions.push_back(tool->get_definition());
-    }
-    return tool_definitions;
-}
-
 std::string
 Agent::run_loop(std::vector<common_chat_msg>& messages,
-                const ResponseCallback& callback)
+                const ResponseCallback& callback,
+                const std::shared_ptr<CancellationToken>& cancellation)
 {
     ensure_system_message(messages);
 
@@ -57,14 +99,40 @@ Agent::run_loop(std::vector<common_chat_msg>& messages,
         cb->before_agent_loop(messages);
     }
 
-    std::vector<common_chat_tool> tool_definitions = get_tool_definitions();
-
     while (true) {
+        if (cancellation) {
+            cancellation->throw_if_cancelled();
+        }
+
         for (const auto& cb : callbacks) {
             cb->before_llm_call(messages);
         }
 
-        auto parsed_msg = model->generate(messages, tool_definitions, callback);
+        // Tool calls the model finished while still generating, already
+        // running on the executor
+        std::vector<PendingToolCall> early_calls;
+        ToolTasksGuard early_calls_guard(early_calls);
+        GenerateOptions options;
+        options.cancellation = cancellation;
+        options.sampling = sampling;
+        if (early_tool_dispatch && tool_executor) {
+            options.on_tool_call = [this, &early_calls, &cancellation](
+                                     const common_chat_tool_call& tool_call) {
+                early_calls.push_back(start_tool_call(tool_call, cancellation));
+            };
+        }
+
+        GenerationStats stats;
+        options.stats = &stats;
+
+        auto parsed_msg =
+          model->generate(messages, tool_definitions, callback, options);
+
+        if (stats.n_prompt_tokens > 0) {
+            for (const auto& cb : callbacks) {
+                cb->on_llm_stats(stats);
+            }
+        }
 
         for (const auto& cb : callbacks) {
             cb->after_llm_call(parsed_msg);
@@ -80,71 +148,200 @@ Agent::run_loop(std::vector<common_chat_msg>& messages,
             return response;
         }
 
+        if (tool_executor &&
+            (parsed_msg.tool_calls.size() > 1 || !early_calls.empty())) {
+            run_tool_calls_parallel(messages,
+                                    parsed_msg.tool_calls,
+                                    std::move(early_calls),
+                                    cancellation);
+            continue;
+        }
+
         for (const auto& tool_call : parsed_msg.tool_calls) {
+            if (cancellation) {
+                cancellation->throw_if_cancelled();
+            }
+
             std::string tool_name = tool_call.name;
             std::string tool_arguments = tool_call.arguments;
 
             ToolResult result("");
-            bool tool_skipped = false;
-
-            try {
-                for (const auto& cb : callbacks) {
-                    cb->before_tool_execution(tool_name, tool_arguments);
-                }
-            } catch (const ToolExecutionSkipped& e) {
-                json response;
-                response["skipped"] = e.get_message();
-                result = response.dump();
-                tool_skipped = true;
+            std::optional<double> duration_ms;
+            if (prepare_tool_call(tool_name, tool_arguments, result)) {
+                result = execute_tool(
+                  tool_name, tool_arguments, duration_ms.emplace());
             }
 
-            if (!tool_skipped) {
-                try {
-                    json args;
-                    try {
-                        args = json::parse(tool_arguments);
-                    } catch (const json::parse_error& e) {
-                        throw ToolArgumentError(tool_name, e.what());
-                    }
-
-                    auto tool_it = std::find_if(
-                      tools.begin(),
-                      tools.end(),
-                      [&tool_name](const std::unique_ptr<Tool>& t) {
-                          return t->get_name() == tool_name;
+            finish_tool_call(
+              messages, tool_call, tool_name, result, duration_ms);
+        }
+    }
+}
+
+std::future<std::string>
+Agent::run_loop_async(std::vector<common_chat_msg>& messages,
+                      ResponseCallback callback,
+                      std::shared_ptr<CancellationToken> cancellation)
+{
+    return std::async(std::launch::async,
+                      [this,
+                       &messages,
+                       callback = std::move(callback),
+                       cancellation = std::move(cancellation)]() {
+                          return run_loop(messages, callback, cancellation);
                       });
+}
 
-                    if (tool_it == tools.end()) {
-                        throw ToolNotFoundError(tool_name);
-                    }
+Agent::PendingToolCall
+Agent::start_tool_call(const common_chat_tool_call& tool_call,
+                       const std::shared_ptr<CancellationToken>& cancellation)
+{
+    if (cancellation) {
+        cancellation->throw_if_cancelled();
+    }
 
-                    result = (*tool_it)->execute(args);
-                } catch (const std::exception& e) {
-                    result = ToolResult::from_exception(e);
-                }
-            }
+    PendingToolCall call;
+    call.tool_call = tool_call;
+    call.tool_name = tool_call.name;
+    call.arguments = tool_call.arguments;
+    if (prepare_tool_call(call.tool_name, call.arguments, call.result)) {
+        // The task gets its own copies so it stays valid if the caller
+        // unwinds before collecting the result
+        call.duration_ms = std::make_shared<double>(0);
+        call.future = tool_executor->submit([this,
+                                             name = call.tool_name,
+                                             arguments = call.arguments,
+                                             duration_ms = call.duration_ms]() {
+            return execute_tool(name, arguments, *duration_ms);
+        });
+    }
+    return call;
+}
 
-            // Single callback invocation - callbacks can convert errors to
-            // results
-            for (const auto& cb : callbacks) {
-                cb->after_tool_execution(tool_name, result);
-            }
+void
+Agent::run_tool_calls_parallel(
+  std::vector<common_chat_msg>& messages,
+  const std::vector<common_chat_tool_call>& calls,
+  std::vector<PendingToolCall> early_calls,
+  const std::shared_ptr<CancellationToken>& cancellation)
+{
+    // Reuse calls started during generation if after_llm_call left them
+    // unchanged; start the rest now. Callbacks run on this thread in call
+    // order: all before_tool_execution first, then all after_tool_execution
+    // once the results are in.
+    ToolTasksGuard early_calls_guard(early_calls);
+    std::vector<PendingToolCall> pending;
+    ToolTasksGuard pending_guard(pending);
+    pending.reserve(calls.size());
+    for (size_t i = 0; i < calls.size(); i++) {
+        if (i < early_calls.size() &&
+            early_calls[i].tool_call.name == calls[i].name &&
+            early_calls[i].tool_call.arguments == calls[i].arguments) {
+            pending.push_back(std::move(early_calls[i]));
+            continue;
+        }
+        // A call after_llm_call changed: its early run must finish before
+        // the replacement starts, so the two never overlap
+        if (i < early_calls.size() && early_calls[i].future.valid()) {
+            early_calls[i].future.wait();
+        }
+        pending.push_back(start_tool_call(calls[i], cancellation));
+    }
 
-            // If still an error after callbacks, re-throw
-            if (result.has_error()) {
-                throw ToolError(tool_name, result.error().message);
-            }
+    for (size_t i = 0; i < calls.size(); i++) {
+        PendingToolCall& call = pending[i];
+        std::optional<double> duration_ms;
+        if (call.future.valid()) {
+            call.result = call.future.get();
+            duration_ms = *call.duration_ms;
+        }
+        finish_tool_call(
+          messages, calls[i], call.tool_name, call.result, duration_ms);
+    }
+}
+
+bool
+Agent::prepare_tool_call(std::string& tool_name,
+                         std::string& arguments,
+                         ToolResult& result)
+{
+    try {
+        for (const auto& cb : callbacks) {
+            cb->before_tool_execution(tool_name, arguments);
+        }
+    } catch (const ToolExecutionSkipped& e) {
+        json response;
+        response["skipped"] = e.get_message();
+        result = response.dump();
+        return false;
+    }
+    return true;
+}
 
-            common_chat_msg tool_msg;
-            tool_msg.role = "tool";
-            tool_msg.content = result.output();
-            tool_msg.tool_call_id = tool_call.id;
-            tool_msg.tool_name = tool_name;
-            messages.push_back(tool_msg);
+ToolResult
+Agent::execute_tool(const std::string& tool_name,
+                    const std::string& arguments,
+                    double& duration_ms)
+{
+    const auto start = std::chrono::steady_clock::now();
+    auto elapsed_ms = [&start]() {
+        return std::chrono::duration<double, std::milli>(
+                 std::chrono::steady_clock::now() - start)
+          .count();
+    };
+    try {
+        json args;
+        try {
+            args = json::parse(arguments);
+        } catch (const json::parse_error& e) {
+            throw ToolArgumentError(tool_name, e.what());
         }
+
+        auto tool_it = tool_index.find(tool_name);
+        if (tool_it == tool_index.end()) {
+            throw ToolNotFoundError(tool_name);
+        }
+
+        ToolResult result = tool_it->second->execute(args);
+        duration_ms = elapsed_ms();
+        return result;
+    } catch (const std::exception& e) {
+        duration_ms = elapsed_ms();
+        return ToolResult::from_exception(e);
     }
 }
 
+void
+Agent::finish_tool_call(std::vector<common_chat_msg>& messages,
+                        const common_chat_tool_call& tool_call,
+                        std::string& tool_name,
+                        ToolResult& result,
+                        std::optional<double> duration_ms)
+{
+    if (duration_ms) {
+        for (const auto& cb : callbacks) {
+            cb->on_tool_stats(tool_name, *duration_ms);
+        }
+    }
+
+    // Single callback invocation - callbacks can convert errors to results
+    for (const auto& cb : callbacks) {
+        cb->after_tool_execution(tool_name, result);
+    }
+
+    // If still an error after callbacks, re-throw
+    if (result.has_error()) {
+        throw ToolError(tool_name, result.error().message);
+    }
+
+    common_chat_msg tool_msg;
+    tool_msg.role = "tool";
+    tool_msg.content = result.output();
+    tool_msg.tool_call_id = tool_call.id;
+    tool_msg.tool_name = tool_name;
+    messages.push_back(tool_msg);
+}
+
 std::vector<llama_token>
 Agent::build_prompt_tokens()
 {
@@ -160,8 +357,6 @@ Agent::build_prompt_tokens()
         system_messages.push_back(system_msg);
     }
 
-    std::vector<common_chat_tool> tool_definitions = get_tool_definitions();
-
     common_chat_templates_inputs inputs;
     inputs.messages = system_messages;
     inputs.tools = tool_definitions;
@@ -174,6 +369,24 @@ Agent::build_prompt_tokens()
     return model->tokenize(params.prompt);
 }
 
+uint64_t
+Agent::prompt_prefix_hash() const
+{
+    // Length-prefix each field so that moving text between them changes it
+    uint64_t hash = fnv1a_64(std::string_view());
+    auto add = [&hash](const std::string& field) {
+        const uint64_t size = field.size();
+        hash = fnv1a_64(field, fnv1a_64_bytes(&size, sizeof(size), hash));
+    };
+    add(instructions);
+    for (const auto& tool : tool_definitions) {
+        add(tool.name);
+        add(tool.description);
+        add(tool.parameters);
+    }
+    return hash;
+}
+
 bool
 Agent::load_or_create_cache(const std::string& cache_path)
 {
@@ -182,7 +395,8 @@ Agent::load_or_create_cache(const std::string& cache_path)
     }
 
     if (std::filesystem::exists(cache_path)) {
-        auto cached_tokens = model->load_cache(cache_path);
+        auto cached_tokens =
+          model->load_cache(cache_path, prompt_prefix_hash());
         if (!cached_tokens.empty()) {
             printf("Loaded prompt cache from '%s' (%zu tokens)\n",
                    cache_path.c_str(),
@@ -203,7 +417,62 @@ Agent::load_or_create_cache(const std::string& cache_path)
     // warms the KV cache
     model->generate_from_tokens(prompt_tokens);
 
-    return model->save_cache(cache_path);
+    return model->save_cache(cache_path, prompt_prefix_hash());
+}
+
+bool
+Agent::load_or_create_cache(const CacheDirectory& cache_dir)
+{
+    if (!model || !model->supports_prompt_cache()) {
+        return false;
+    }
+
+    auto prompt_tokens = build_prompt_tokens();
+    if (prompt_tokens.empty()) {
+        return true;
+    }
+
+    const uint64_t key =
+      fnv1a_64_bytes(prompt_tokens.data(),
+                     prompt_tokens.size() * sizeof(llama_token),
+                     model->cache_fingerprint());
+    const std::string cache_path = cache_dir.path_for(key);
+    const uint64_t tools_hash = prompt_prefix_hash();
+
+    if (std::filesystem::exists(cache_path)) {
+        auto cached_tokens = model->load_cache(cache_path, tools_hash);
+        if (cached_tokens == prompt_tokens) {
+            cache_dir.touch(cache_path);
+            printf("Loaded prompt cache from '%s' (%zu tokens)\n",
+                   cache_path.c_str(),
+                   cached_tokens.size());
+            return true;
+        }
+    }
+
+    printf("Creating prompt cache at '%s' (%zu tokens)\n",
+           cache_path.c_str(),
+           prompt_tokens.size());
+
+    // warms the KV cache
+    model->generate_from_tokens(prompt_tokens);
+
+    if (!model->save_cache(cache_path, tools_hash)) {
+        return false;
+    }
+    cache_dir.evict(cache_path);
+    return true;
+}
+
+bool
+Agent::share_prompt_prefix()
+{
+    auto prompt_tokens = build_prompt_tokens();
+    if (prompt_tokens.empty()) {
+        return false;
+    }
+
+    return model->share_prefix(prompt_tokens);
 }
 
 } // namespace agent_cpp
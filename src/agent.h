@@ -1,13 +1,18 @@
 #pragma once
 
+#include "cache_directory.h"
 #include "callbacks.h"
 #include "chat.h"
 #include "llama.h"
 #include "model.h"
 #include "tool.h"
+#include "tool_executor.h"
 #include <functional>
+#include <future>
 #include <memory>
+#include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace agent_cpp {
@@ -19,10 +24,29 @@ class Agent
     std::string instructions;
     std::shared_ptr<IModel> model;
     std::vector<std::unique_ptr<Tool>> tools;
+    std::unordered_map<std::string, Tool*> tool_index; // By name, first wins
+    std::vector<common_chat_tool> tool_definitions;    // Same order as tools
+    std::shared_ptr<ToolExecutor> tool_executor;
+    bool early_tool_dispatch = false;
+    std::optional<SamplingParams> sampling; // For every LLM call if set
+
+    // A tool call handed to tool_executor
+    struct PendingToolCall
+    {
+        common_chat_tool_call tool_call;     // As emitted by the model
+        std::string tool_name;               // After before_tool_execution
+        std::string arguments;
+        ToolResult result{ "" };             // Set directly if skipped
+        std::future<ToolResult> future;      // Invalid if skipped
+        std::shared_ptr<double> duration_ms; // Set by the task, null if skipped
+    };
 
     // Helper to ensure system message with instructions is at the start
     void ensure_system_message(std::vector<common_chat_msg>& messages);
 
+    // Add a tool's name and definition to the lookup caches
+    void index_tool(Tool* tool);
+
   public:
     Agent(std::shared_ptr<IModel> model,
           std::vector<std::unique_ptr<Tool>> tools,
@@ -33,12 +57,65 @@ class Agent
     // Assumes the latest user message is already in the messages vector
     // Executes tool calls as needed, and returns the final response
     // The callback is called for each token generated by the model
-    std::string run_loop(std::vector<common_chat_msg>& messages,
-                         const ResponseCallback& callback = nullptr);
+    // If cancellation is given, it is checked between decode steps, before
+    // each LLM call and before each tool execution; the loop then throws
+    // CancelledError
+    std::string run_loop(
+      std::vector<common_chat_msg>& messages,
+      const ResponseCallback& callback = nullptr,
+      const std::shared_ptr<CancellationToken>& cancellation = nullptr);
+
+    // Run run_loop on a new thread. messages and the agent must stay alive
+    // until the future is ready; its exceptions (including CancelledError)
+    // are rethrown by future::get. The callback runs on that thread.
+    std::future<std::string> run_loop_async(
+      std::vector<common_chat_msg>& messages,
+      ResponseCallback callback = nullptr,
+      std::shared_ptr<CancellationToken> cancellation = nullptr);
+
+    // Run the tool calls of one assistant message concurrently on executor
+    // (nullptr, the default, runs them one after another). Callbacks still
+    // run on the calling thread in call order, but all before_tool_execution
+    // calls happen before the tools start, and all after_tool_execution calls
+    // once they have finished. Tool messages are appended in call order.
+    // Every tool must be safe to execute concurrently.
+    void set_tool_executor(std::shared_ptr<ToolExecutor> executor)
+    {
+        tool_executor = std::move(executor);
+    }
+
+    // Start each tool call on the tool executor as soon as the model has
+    // finished emitting it, while later calls are still being generated.
+    // Needs a tool executor and a model that reports tool calls early (see
+    // GenerateOptions::on_tool_call). before_tool_execution then runs during
+    // generation, before after_llm_call. A call that after_llm_call changes
+    // runs again with the new name or arguments once its early run has
+    // finished (before_tool_execution fires for both runs, and the early
+    // result is discarded); a call it removes has still run once. If
+    // generation fails, run_loop waits for the early calls before throwing.
+    void set_early_tool_dispatch(bool enabled)
+    {
+        early_tool_dispatch = enabled;
+    }
+
+    // Sample every LLM call with these settings instead of the model's
+    // configuration (see GenerateOptions::sampling); nullopt restores them
+    void set_sampling(std::optional<SamplingParams> params)
+    {
+        sampling = std::move(params);
+    }
+
+    // Register another tool; it is offered to the model from the next LLM
+    // call on. Not safe while tool calls are running on a tool executor.
+    void add_tool(std::unique_ptr<Tool> tool);
 
     // Get the tool definitions for all registered tools
     // Useful for building prompts for caching
-    [[nodiscard]] std::vector<common_chat_tool> get_tool_definitions() const;
+    [[nodiscard]] const std::vector<common_chat_tool>& get_tool_definitions()
+      const
+    {
+        return tool_definitions;
+    }
 
     // Get the instructions string
     [[nodiscard]] const std::string& get_instructions() const
@@ -53,9 +130,62 @@ class Agent
     // Returns true on success, false on failure
     bool load_or_create_cache(const std::string& cache_path);
 
+    // Same, with the file in cache_dir chosen from a hash of the rendered
+    // prompt prefix tokens and the model's cache fingerprint. Agents with
+    // the same instructions and tools share a file; changing either picks
+    // a new one instead of loading a stale cache.
+    // Returns true on success, false on failure
+    bool load_or_create_cache(const CacheDirectory& cache_dir);
+
+    // Prefill the system prompt and tool definitions once in the model's
+    // shared context (see InferenceEngine::share_prefix). Agents with the same
+    // instructions and tools then fork the prefilled KV cache instead of
+    // decoding it again. Call before the first run_loop.
+    // Returns false if the model does not support shared prefixes
+    bool share_prompt_prefix();
+
   private:
     // Build the agent's prompt tokens (system message + tool definitions)
     std::vector<llama_token> build_prompt_tokens();
+
+    // Hash of the instructions and tool definitions, stored in cache files
+    // so a cache built for another prompt prefix is rejected
+    [[nodiscard]] uint64_t prompt_prefix_hash() const;
+
+    // Run before_tool_execution callbacks. Returns false if a callback
+    // skipped the call, with the skip message stored in result.
+    bool prepare_tool_call(std::string& tool_name,
+                           std::string& arguments,
+                           ToolResult& result);
+
+    // Parse the arguments and execute the named tool; errors become results
+    // duration_ms is set to the time the execution took
+    ToolResult execute_tool(const std::string& tool_name,
+                            const std::string& arguments,
+                            double& duration_ms);
+
+    // Run on_tool_stats (if the call was executed) and after_tool_execution
+    // callbacks and append the tool message
+    // Throws ToolError if the result is still an error
+    void finish_tool_call(std::vector<common_chat_msg>& messages,
+                          const common_chat_tool_call& tool_call,
+                          std::string& tool_name,
+                          ToolResult& result,
+                          std::optional<double> duration_ms);
+
+    // Run before_tool_execution callbacks and submit the call to
+    // tool_executor unless a callback skipped it
+    // Throws CancelledError if cancellation is set
+    PendingToolCall start_tool_call(
+      const common_chat_tool_call& tool_call,
+      const std::shared_ptr<CancellationToken>& cancellation);
+
+    // Execute calls on tool_executor, keeping callback and message order
+    void run_tool_calls_parallel(
+      std::vector<common_chat_msg>& messages,
+      const std::vector<common_chat_tool_call>& calls,
+      std::vector<PendingToolCall> early_calls,
+      const std::shared_ptr<CancellationToken>& cancellation);
 };
 
 } // namespace agent_cpp
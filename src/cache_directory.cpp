@@ -0,0 +1,150 @@
+#include "cache_directory.h"
+#include "error.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace agent_cpp {
+
+namespace {
+
+constexpr const char* CACHE_FILE_EXTENSION = ".kvc";
+
+// CacheFile::save writes to "<name>.kvc.tmp.<pid>.<n>" and renames it; one
+// this old was left behind by a writer that crashed
+constexpr auto STALE_TEMP_FILE_AGE = std::chrono::hours(1);
+
+struct CacheEntry
+{
+    fs::path path;
+    uint64_t size;
+    fs::file_time_type last_used;
+};
+
+// Cache files in dir; files removed concurrently by another process are
+// skipped
+std::vector<CacheEntry>
+list_cache_files(const std::string& dir)
+{
+    std::vector<CacheEntry> entries;
+    std::error_code ec;
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end;
+         it.increment(ec)) {
+        if (it->path().extension() != CACHE_FILE_EXTENSION) {
+            continue;
+        }
+        std::error_code size_ec;
+        std::error_code time_ec;
+        const uint64_t size = it->file_size(size_ec);
+        const auto last_used = it->last_write_time(time_ec);
+        if (!size_ec && !time_ec) {
+            entries.push_back({ it->path(), size, last_used });
+        }
+    }
+    return entries;
+}
+
+void
+remove_stale_temp_files(const std::string& dir)
+{
+    const std::string marker = std::string(CACHE_FILE_EXTENSION) + ".tmp.";
+    const auto now = fs::file_time_type::clock::now();
+    std::error_code ec;
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end;
+         it.increment(ec)) {
+        if (it->path().filename().string().find(marker) ==
+            std::string::npos) {
+            continue;
+        }
+        std::error_code entry_ec;
+        const auto last_write = it->last_write_time(entry_ec);
+        if (!entry_ec && now - last_write > STALE_TEMP_FILE_AGE) {
+            fs::remove(it->path(), entry_ec);
+        }
+    }
+}
+
+} // anonymous namespace
+
+CacheDirectory::CacheDirectory(std::string dir, uint64_t max_bytes)
+  : dir_(std::move(dir))
+  , max_bytes_(max_bytes)
+{
+    std::error_code ec;
+    fs::create_directories(dir_, ec);
+    if (ec || !fs::is_directory(dir_)) {
+        throw Error("cannot create cache directory '" + dir_ + "'");
+    }
+}
+
+std::string
+CacheDirectory::path_for(uint64_t key) const
+{
+    char name[32];
+    std::snprintf(name,
+                  sizeof(name),
+                  "%016llx%s",
+                  static_cast<unsigned long long>(key),
+                  CACHE_FILE_EXTENSION);
+    return (fs::path(dir_) / name).string();
+}
+
+void
+CacheDirectory::touch(const std::string& path) const
+{
+    // The modification time doubles as the last use for eviction
+    std::error_code ec;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+}
+
+void
+CacheDirectory::evict(const std::string& keep) const
+{
+    remove_stale_temp_files(dir_);
+    if (max_bytes_ == 0) {
+        return;
+    }
+
+    auto entries = list_cache_files(dir_);
+    uint64_t total = 0;
+    for (const auto& entry : entries) {
+        total += entry.size;
+    }
+
+    std::sort(entries.begin(),
+              entries.end(),
+              [](const CacheEntry& a, const CacheEntry& b) {
+                  return a.last_used < b.last_used;
+              });
+    const fs::path keep_path(keep);
+    for (const auto& entry : entries) {
+        if (total <= max_bytes_) {
+            break;
+        }
+        std::error_code ec;
+        if (!keep.empty() && fs::equivalent(entry.path, keep_path, ec)) {
+            continue;
+        }
+        if (fs::remove(entry.path, ec)) {
+            total -= entry.size;
+        }
+    }
+}
+
+uint64_t
+CacheDirectory::size_bytes() const
+{
+    uint64_t total = 0;
+    for (const auto& entry : list_cache_files(dir_)) {
+        total += entry.size;
+    }
+    return total;
+}
+
+} // namespace agent_cpp
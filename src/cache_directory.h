@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace agent_cpp {
+
+/// @brief Content-addressed directory of prompt cache files.
+///
+/// Each file is named after a 64-bit key derived from what it holds (see
+/// Agent::load_or_create_cache), so agents, processes and restarts that
+/// render the same prompt prefix share one file and different prefixes never
+/// collide. Loading a file marks it as used; after a file is written, the
+/// least recently used others are deleted until the directory fits in
+/// max_bytes.
+class CacheDirectory
+{
+  public:
+    /// @param dir Directory holding the cache files, created if missing
+    /// @param max_bytes Size bound for the files in it (0 for no bound)
+    /// @throws agent_cpp::Error if the directory cannot be created
+    explicit CacheDirectory(std::string dir, uint64_t max_bytes = 0);
+
+    /// @brief Path of the cache file for a key
+    [[nodiscard]] std::string path_for(uint64_t key) const;
+
+    /// @brief Mark a cache file as recently used
+    void touch(const std::string& path) const;
+
+    /// @brief Delete least recently used cache files until the directory
+    /// fits in max_bytes. keep is never deleted, even if it alone exceeds it.
+    /// Temporary files of writes that did not finish within an hour are
+    /// deleted as well, with or without a bound.
+    void evict(const std::string& keep = {}) const;
+
+    /// @brief Total size of the cache files in the directory
+    [[nodiscard]] uint64_t size_bytes() const;
+
+    [[nodiscard]] const std::string& dir() const { return dir_; }
+    [[nodiscard]] uint64_t max_bytes() const { return max_bytes_; }
+
+  private:
+    std::string dir_;
+    uint64_t max_bytes_;
+};
+
+} // namespace agent_cpp
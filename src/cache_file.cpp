@@ -0,0 +1,469 @@
+#include "cache_file.h"
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <process.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace agent_cpp {
+
+namespace {
+
+constexpr char CACHE_FILE_MAGIC[8] = { 'A', 'G', 'T', 'K', 'V', 'C', 'C', 'H' };
+
+// Payloads start on a page boundary so they can be mapped on their own
+constexpr uint64_t PAYLOAD_ALIGNMENT = 4096;
+
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t n_sequences;
+    uint64_t model_hash;
+    uint64_t template_hash;
+    uint64_t tools_hash;
+    int32_t type_k;
+    int32_t type_v;
+    uint64_t n_tokens; // Over all sequences
+};
+static_assert(sizeof(FileHeader) == 56, "FileHeader must have no padding");
+
+constexpr char SEQUENCE_STATE_MAGIC[8] = { 'A', 'G', 'T', 'K',
+                                           'V', 'S', 'E', 'Q' };
+
+// Prefix of SequenceState::serialize output, followed by the tokens and data
+struct SequenceStateHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t model_hash;
+    uint64_t template_hash;
+    uint64_t tools_hash;
+    int32_t type_k;
+    int32_t type_v;
+    uint64_t n_tokens;
+    uint64_t n_data;
+};
+static_assert(sizeof(SequenceStateHeader) == 64,
+              "SequenceStateHeader must have no padding");
+
+struct Entry
+{
+    int32_t seq_id;
+    uint32_t reserved;
+    uint64_t n_tokens;
+    uint64_t tokens_offset;
+    uint64_t state_offset;
+    uint64_t state_size;
+};
+static_assert(sizeof(Entry) == 40, "Entry must have no padding");
+
+uint64_t
+align_up(uint64_t offset)
+{
+    return (offset + PAYLOAD_ALIGNMENT - 1) / PAYLOAD_ALIGNMENT *
+           PAYLOAD_ALIGNMENT;
+}
+
+// Temporary file next to path, unique across threads and processes, so
+// concurrent writers of the same cache file never share one
+std::string
+temp_path_for(const std::string& path)
+{
+    static std::atomic<uint64_t> counter{ 0 };
+#ifdef _WIN32
+    const long long pid = _getpid();
+#else
+    const long long pid = getpid();
+#endif
+    return path + ".tmp." + std::to_string(pid) + "." +
+           std::to_string(counter++);
+}
+
+// Flush a written file to disk, so that a rename after a power loss cannot
+// expose a file whose data never reached the disk
+bool
+sync_file(const std::string& path)
+{
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path.c_str(),
+                                GENERIC_WRITE,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                nullptr,
+                                OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL,
+                                nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    const bool ok = FlushFileBuffers(handle) != 0;
+    CloseHandle(handle);
+    return ok;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    const bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#endif
+}
+
+// Make a rename in the file's directory durable (a no-op on Windows, where
+// the rename is flushed with the file system metadata)
+void
+sync_parent_directory(const std::string& path)
+{
+#ifdef _WIN32
+    (void)path;
+#else
+    std::string dir = std::filesystem::path(path).parent_path().string();
+    int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+#endif
+}
+
+// The table follows the 8-byte aligned header in a page-aligned mapping
+const Entry&
+entry_at(const uint8_t* data, size_t i)
+{
+    return reinterpret_cast<const Entry*>(data + sizeof(FileHeader))[i];
+}
+
+} // anonymous namespace
+
+uint64_t
+fnv1a_64_bytes(const void* data, size_t size, uint64_t seed)
+{
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+uint64_t
+CacheFileKey::hash() const
+{
+    uint64_t h = fnv1a_64_bytes(&model_hash, sizeof(model_hash));
+    h = fnv1a_64_bytes(&template_hash, sizeof(template_hash), h);
+    h = fnv1a_64_bytes(&tools_hash, sizeof(tools_hash), h);
+    h = fnv1a_64_bytes(&type_k, sizeof(type_k), h);
+    return fnv1a_64_bytes(&type_v, sizeof(type_v), h);
+}
+
+std::vector<uint8_t>
+SequenceState::serialize() const
+{
+    SequenceStateHeader header{};
+    std::memcpy(header.magic, SEQUENCE_STATE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_FILE_VERSION;
+    header.model_hash = key.model_hash;
+    header.template_hash = key.template_hash;
+    header.tools_hash = key.tools_hash;
+    header.type_k = key.type_k;
+    header.type_v = key.type_v;
+    header.n_tokens = tokens.size();
+    header.n_data = data.size();
+
+    const size_t tokens_size = sizeof(llama_token) * tokens.size();
+    std::vector<uint8_t> bytes(sizeof(header) + tokens_size + data.size());
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    std::memcpy(bytes.data() + sizeof(header), tokens.data(), tokens_size);
+    std::memcpy(
+      bytes.data() + sizeof(header) + tokens_size, data.data(), data.size());
+    return bytes;
+}
+
+std::optional<SequenceState>
+SequenceState::deserialize(const uint8_t* bytes, size_t size)
+{
+    SequenceStateHeader header;
+    if (size < sizeof(header)) {
+        return std::nullopt;
+    }
+    std::memcpy(&header, bytes, sizeof(header));
+    if (std::memcmp(header.magic, SEQUENCE_STATE_MAGIC, sizeof(header.magic)) !=
+          0 ||
+        header.version != CACHE_FILE_VERSION) {
+        return std::nullopt;
+    }
+    // Sizes from the wire are checked one at a time to rule out overflow
+    const uint64_t available = size - sizeof(header);
+    if (header.n_tokens > available / sizeof(llama_token) ||
+        header.n_data != available - sizeof(llama_token) * header.n_tokens) {
+        return std::nullopt;
+    }
+
+    SequenceState state;
+    state.key.model_hash = header.model_hash;
+    state.key.template_hash = header.template_hash;
+    state.key.tools_hash = header.tools_hash;
+    state.key.type_k = header.type_k;
+    state.key.type_v = header.type_v;
+    const uint8_t* tokens_begin = bytes + sizeof(header);
+    state.tokens.resize(header.n_tokens);
+    std::memcpy(state.tokens.data(),
+                tokens_begin,
+                sizeof(llama_token) * state.tokens.size());
+    const uint8_t* data_begin =
+      tokens_begin + sizeof(llama_token) * header.n_tokens;
+    state.data.assign(data_begin, data_begin + header.n_data);
+    return state;
+}
+
+bool
+CacheFile::save(const std::string& path,
+                const CacheFileKey& key,
+                llama_context* ctx,
+                const std::vector<Sequence>& sequences)
+{
+    const std::string tmp_path = temp_path_for(path);
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return false;
+        }
+
+        FileHeader header{};
+        std::memcpy(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic));
+        header.version = CACHE_FILE_VERSION;
+        header.n_sequences = static_cast<uint32_t>(sequences.size());
+        header.model_hash = key.model_hash;
+        header.template_hash = key.template_hash;
+        header.tools_hash = key.tools_hash;
+        header.type_k = key.type_k;
+        header.type_v = key.type_v;
+
+        std::vector<Entry> table(sequences.size());
+        uint64_t offset = sizeof(FileHeader) + sizeof(Entry) * table.size();
+        for (size_t i = 0; i < sequences.size(); i++) {
+            table[i] = Entry{};
+            table[i].seq_id = sequences[i].seq_id;
+            table[i].n_tokens = sequences[i].tokens->size();
+            table[i].tokens_offset = offset;
+            offset += sizeof(llama_token) * table[i].n_tokens;
+            header.n_tokens += table[i].n_tokens;
+        }
+
+        // The table is written again once the payload sizes are known
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(table.data()),
+                  sizeof(Entry) * table.size());
+        for (const auto& sequence : sequences) {
+            out.write(reinterpret_cast<const char*>(sequence.tokens->data()),
+                      sizeof(llama_token) * sequence.tokens->size());
+        }
+
+        std::vector<uint8_t> buffer;
+        for (size_t i = 0; i < sequences.size(); i++) {
+            const std::vector<uint8_t>* state = sequences[i].state;
+            size_t n_written = state != nullptr ? state->size() : 0;
+            if (state == nullptr && ctx != nullptr) {
+                buffer.resize(
+                  llama_state_seq_get_size(ctx, sequences[i].seq_id));
+                n_written = llama_state_seq_get_data(
+                  ctx, buffer.data(), buffer.size(), sequences[i].seq_id);
+                state = &buffer;
+            }
+            if (n_written == 0) {
+                out.close();
+                std::error_code ec;
+                std::filesystem::remove(tmp_path, ec);
+                return false;
+            }
+
+            const uint64_t aligned = align_up(offset);
+            static const char zeros[PAYLOAD_ALIGNMENT] = {};
+            out.write(zeros, static_cast<std::streamsize>(aligned - offset));
+            out.write(reinterpret_cast<const char*>(state->data()),
+                      static_cast<std::streamsize>(n_written));
+            table[i].state_offset = aligned;
+            table[i].state_size = n_written;
+            offset = aligned + n_written;
+        }
+
+        out.seekp(sizeof(FileHeader));
+        out.write(reinterpret_cast<const char*>(table.data()),
+                  sizeof(Entry) * table.size());
+        out.close();
+        if (!out || !sync_file(tmp_path)) {
+            std::error_code ec;
+            std::filesystem::remove(tmp_path, ec);
+            return false;
+        }
+    }
+
+    // Readers see either the old file or the complete new one
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    sync_parent_directory(path);
+    return true;
+}
+
+std::unique_ptr<CacheFile>
+CacheFile::open(const std::string& path, const CacheFileKey& expected)
+{
+    std::unique_ptr<CacheFile> file(new CacheFile());
+
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(path.c_str(),
+                                GENERIC_READ,
+                                FILE_SHARE_READ,
+                                nullptr,
+                                OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL,
+                                nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    file->file_handle_ = handle;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+        return nullptr;
+    }
+    file->size_ = static_cast<size_t>(size.QuadPart);
+    file->mapping_handle_ =
+      CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (file->mapping_handle_ == nullptr) {
+        return nullptr;
+    }
+    file->data_ = static_cast<const uint8_t*>(
+      MapViewOfFile(file->mapping_handle_, FILE_MAP_READ, 0, 0, 0));
+    if (file->data_ == nullptr) {
+        return nullptr;
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // The mapping keeps the file open
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    file->data_ = static_cast<const uint8_t*>(data);
+    file->size_ = static_cast<size_t>(st.st_size);
+#endif
+
+    if (file->size_ < sizeof(FileHeader)) {
+        return nullptr;
+    }
+    FileHeader header;
+    std::memcpy(&header, file->data_, sizeof(header));
+    if (std::memcmp(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic)) !=
+          0 ||
+        header.version != CACHE_FILE_VERSION) {
+        return nullptr;
+    }
+
+    CacheFileKey key;
+    key.model_hash = header.model_hash;
+    key.template_hash = header.template_hash;
+    key.tools_hash = header.tools_hash;
+    key.type_k = header.type_k;
+    key.type_v = header.type_v;
+    if (key != expected) {
+        return nullptr;
+    }
+
+    // Reject a truncated file now rather than fault on it later
+    const uint64_t table_end =
+      sizeof(FileHeader) + sizeof(Entry) * uint64_t(header.n_sequences);
+    if (table_end > file->size_) {
+        return nullptr;
+    }
+    // Offsets and sizes are checked one at a time against the bytes left,
+    // so a corrupted table cannot overflow past the check
+    const uint64_t size = file->size_;
+    file->n_sequences_ = header.n_sequences;
+    for (size_t i = 0; i < file->n_sequences_; i++) {
+        const Entry& e = entry_at(file->data_, i);
+        if (e.tokens_offset > size ||
+            e.n_tokens > (size - e.tokens_offset) / sizeof(llama_token) ||
+            e.state_offset > size || e.state_size > size - e.state_offset) {
+            return nullptr;
+        }
+    }
+
+    return file;
+}
+
+CacheFile::~CacheFile()
+{
+#ifdef _WIN32
+    if (data_ != nullptr) {
+        UnmapViewOfFile(data_);
+    }
+    if (mapping_handle_ != nullptr) {
+        CloseHandle(mapping_handle_);
+    }
+    if (file_handle_ != nullptr) {
+        CloseHandle(file_handle_);
+    }
+#else
+    if (data_ != nullptr) {
+        munmap(const_cast<uint8_t*>(data_), size_);
+    }
+#endif
+}
+
+llama_seq_id
+CacheFile::seq_id(size_t i) const
+{
+    return entry_at(data_, i).seq_id;
+}
+
+std::vector<llama_token>
+CacheFile::tokens(size_t i) const
+{
+    const Entry& e = entry_at(data_, i);
+    std::vector<llama_token> tokens(e.n_tokens);
+    std::memcpy(
+      tokens.data(), data_ + e.tokens_offset, sizeof(llama_token) * e.n_tokens);
+    return tokens;
+}
+
+bool
+CacheFile::load_sequence(size_t i, llama_context* ctx, llama_seq_id dest) const
+{
+    const Entry& e = entry_at(data_, i);
+    return llama_state_seq_set_data(
+             ctx, data_ + e.state_offset, e.state_size, dest) > 0;
+}
+
+} // namespace agent_cpp
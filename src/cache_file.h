@@ -0,0 +1,141 @@
+#pragma once
+
+#include "llama.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace agent_cpp {
+
+constexpr uint32_t CACHE_FILE_VERSION = 1;
+
+/// @brief 64-bit FNV-1a hash, chainable through the seed
+uint64_t
+fnv1a_64_bytes(const void* data,
+               size_t size,
+               uint64_t seed = 0xcbf29ce484222325ULL);
+
+inline uint64_t
+fnv1a_64(std::string_view text, uint64_t seed = 0xcbf29ce484222325ULL)
+{
+    return fnv1a_64_bytes(text.data(), text.size(), seed);
+}
+
+/// @brief What a saved KV cache depends on. A file whose key differs from
+/// the loader's was built for another model, template, prompt prefix or KV
+/// layout and is rejected from its header alone.
+struct CacheFileKey
+{
+    uint64_t model_hash = 0;    // ModelWeights::fingerprint()
+    uint64_t template_hash = 0; // ModelWeights::template_fingerprint()
+    uint64_t tools_hash = 0;    // Instructions and tool definitions, 0 if none
+    int32_t type_k = -1;        // ggml_type of the K cache
+    int32_t type_v = -1;        // ggml_type of the V cache
+
+    bool operator==(const CacheFileKey& other) const
+    {
+        return model_hash == other.model_hash &&
+               template_hash == other.template_hash &&
+               tools_hash == other.tools_hash && type_k == other.type_k &&
+               type_v == other.type_v;
+    }
+    bool operator!=(const CacheFileKey& other) const
+    {
+        return !(*this == other);
+    }
+
+    /// @brief Hash of all fields
+    [[nodiscard]] uint64_t hash() const;
+};
+
+/// @brief KV cache of one sequence, detached from its context so it can be
+/// moved to another Model or process, or parked while a session is idle
+struct SequenceState
+{
+    CacheFileKey key;                // Of the context it was exported from
+    std::vector<llama_token> tokens; // Tokens held by the sequence
+    std::vector<uint8_t> data;       // llama_state_seq_get_data output
+
+    /// @brief Flat encoding for a socket, pipe or file
+    [[nodiscard]] std::vector<uint8_t> serialize() const;
+
+    /// @brief Decode the output of serialize()
+    /// @return nullopt if bytes are truncated or from another format version
+    static std::optional<SequenceState> deserialize(const uint8_t* bytes,
+                                                    size_t size);
+};
+
+/// @brief Saved KV cache sequences in a versioned, memory-mappable file.
+///
+/// Layout: a fixed header (magic, version, CacheFileKey, token count), a
+/// table with one entry per sequence, each sequence's tokens, then each
+/// sequence's llama_state_seq_get_data payload at a page-aligned offset.
+///
+/// open() maps the file and validates the header and table, so a stale or
+/// foreign file is rejected after touching its first page. A sequence's
+/// payload is only paged in when load_sequence() hands it to llama.cpp, so
+/// restoring one conversation from a multi-GB file reads just that part.
+class CacheFile
+{
+  public:
+    /// @brief A sequence to save: its id in ctx and the tokens it holds
+    struct Sequence
+    {
+        llama_seq_id seq_id = 0;
+        const std::vector<llama_token>* tokens = nullptr;
+        // Saved state (llama_state_seq_get_data) to write instead of reading
+        // it from ctx, e.g. a snapshot taken earlier on another thread
+        const std::vector<uint8_t>* state = nullptr;
+    };
+
+    /// @brief Write the sequences of ctx to path, replacing it atomically
+    /// through a uniquely named temporary file, fsync and rename, so
+    /// concurrent writers and power loss never leave a partial file. ctx may
+    /// be null if every sequence carries its state.
+    /// @return false if the state could not be read or the file written
+    static bool save(const std::string& path,
+                     const CacheFileKey& key,
+                     llama_context* ctx,
+                     const std::vector<Sequence>& sequences);
+
+    /// @brief Map a cache file and check it against the expected key
+    /// @return nullptr if the file is missing, truncated, from another
+    /// format version, or was saved with a different key
+    static std::unique_ptr<CacheFile> open(const std::string& path,
+                                           const CacheFileKey& expected);
+
+    ~CacheFile();
+
+    CacheFile(const CacheFile&) = delete;
+    CacheFile& operator=(const CacheFile&) = delete;
+
+    [[nodiscard]] size_t n_sequences() const { return n_sequences_; }
+
+    /// @brief Sequence id the i-th sequence was saved from
+    [[nodiscard]] llama_seq_id seq_id(size_t i) const;
+
+    /// @brief Tokens held by the i-th sequence
+    [[nodiscard]] std::vector<llama_token> tokens(size_t i) const;
+
+    /// @brief Restore the i-th sequence into dest_seq_id of ctx, which must
+    /// be empty
+    /// @return false if llama.cpp rejects the state (e.g. ctx is too small)
+    bool load_sequence(size_t i, llama_context* ctx, llama_seq_id dest) const;
+
+  private:
+    CacheFile() = default;
+
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    size_t n_sequences_ = 0;
+#ifdef _WIN32
+    void* file_handle_ = nullptr;
+    void* mapping_handle_ = nullptr;
+#endif
+};
+
+} // namespace agent_cpp
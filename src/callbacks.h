@@ -2,6 +2,7 @@
 
 #include "chat.h"
 #include "error.h"
+#include "model.h"
 #include "tool_result.h"
 #include <string>
 #include <vector>
@@ -33,11 +34,18 @@ class Callback
     // the prompt (can be modified)
     virtual void before_llm_call(std::vector<common_chat_msg>& messages) {}
 
+    // Called after an LLM call with its token counts and timings, before
+    // after_llm_call. Not called if the model does not report stats.
+    // @param stats: Prefill/decode tokens and times of the call
+    virtual void on_llm_stats(const GenerationStats& stats) {}
+
     // Called after receiving response from the LLM and parsing it
     // @param parsed_msg: The parsed message from the LLM (can be modified)
     virtual void after_llm_call(common_chat_msg& parsed_msg) {}
 
     // Called before executing a tool call
+    // With Agent::set_early_tool_dispatch this runs while the model is still
+    // generating, before after_llm_call
     // @param tool_name: Name of the tool to be executed (can be modified)
     // @param arguments: JSON string of the tool arguments (can be modified)
     // @throws ToolExecutionSkipped: Throw this exception to skip tool
@@ -48,6 +56,16 @@ class Callback
     {
     }
 
+    // Called after a tool has executed, before after_tool_execution. Not
+    // called for skipped calls.
+    // @param tool_name: Name of the tool that was executed
+    // @param duration_ms: Time spent executing the tool, excluding callbacks
+    // and time queued on a tool executor
+    virtual void on_tool_stats(const std::string& tool_name,
+                               double duration_ms)
+    {
+    }
+
     // Called after tool execution completes (success or error)
     // @param tool_name: Name of the tool that was executed (can be modified)
     // @param result: The result - either output string or ToolError
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "error.h"
+#include <atomic>
+
+namespace agent_cpp {
+
+/// @brief Cooperative cancellation flag shared between a caller and a
+/// running generation or agent loop.
+///
+/// cancel() may be called from any thread. Model checks the token between
+/// decode steps and Agent between LLM calls and tool executions; the running
+/// call then throws CancelledError. A tool that is already executing is not
+/// interrupted.
+class CancellationToken
+{
+  public:
+    void cancel() noexcept
+    {
+        cancelled_.store(true, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool is_cancelled() const noexcept
+    {
+        return cancelled_.load(std::memory_order_relaxed);
+    }
+
+    /// @throws CancelledError if cancel() has been called
+    void throw_if_cancelled() const
+    {
+        if (is_cancelled()) {
+            throw CancelledError();
+        }
+    }
+
+  private:
+    std::atomic<bool> cancelled_{ false };
+};
+
+} // namespace agent_cpp
@@ -0,0 +1,80 @@
+#include "checkpoint_writer.h"
+
+namespace agent_cpp {
+
+CheckpointWriter::CheckpointWriter(std::string path, const CacheFileKey& key)
+  : path_(std::move(path))
+  , key_(key)
+{
+    thread_ = std::thread([this]() { run(); });
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+}
+
+bool
+CheckpointWriter::snapshot(llama_context* ctx,
+                           llama_seq_id seq_id,
+                           const std::vector<llama_token>& tokens)
+{
+    // The buffers keep their capacity, so repeated snapshots of a growing
+    // conversation rarely allocate
+    scratch_.tokens.assign(tokens.begin(), tokens.end());
+    scratch_.state.resize(llama_state_seq_get_size(ctx, seq_id));
+    const size_t n_written = llama_state_seq_get_data(
+      ctx, scratch_.state.data(), scratch_.state.size(), seq_id);
+    if (n_written == 0) {
+        return false; // A snapshot still waiting is written as queued
+    }
+    scratch_.state.resize(n_written);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::swap(back_, scratch_);
+        back_ready_ = true;
+    }
+    cv_.notify_all();
+    return true;
+}
+
+bool
+CheckpointWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return !back_ready_ && !writing_; });
+    return last_write_ok_;
+}
+
+void
+CheckpointWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this]() { return back_ready_ || stop_; });
+        if (!back_ready_) {
+            return; // Stopped with nothing left to write
+        }
+
+        std::swap(front_, back_);
+        back_ready_ = false;
+        writing_ = true;
+        lock.unlock();
+
+        const bool ok = CacheFile::save(
+          path_, key_, nullptr, { { 0, &front_.tokens, &front_.state } });
+
+        lock.lock();
+        writing_ = false;
+        last_write_ok_ = ok;
+        cv_.notify_all();
+    }
+}
+
+} // namespace agent_cpp
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "cache_file.h"
+#include "llama.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace agent_cpp {
+
+/// @brief Writes snapshots of one KV cache sequence to a CacheFile on a
+/// background thread.
+///
+/// snapshot() copies the sequence state out of the context into a scratch
+/// buffer, then queues it as the back buffer and returns; the writer thread
+/// swaps that with its front buffer and writes it to disk through a
+/// temporary file and rename. Only the copy runs on the caller's thread, and
+/// the file on disk is always a complete snapshot. A snapshot taken while
+/// the previous one is still being written replaces any snapshot still
+/// waiting, so a slow disk costs checkpoints but never blocks the caller; a
+/// snapshot that fails to read leaves the waiting one in place.
+class CheckpointWriter
+{
+  public:
+    /// @param path File the snapshots are written to
+    /// @param key Key stored in the file, checked by CacheFile::open
+    CheckpointWriter(std::string path, const CacheFileKey& key);
+
+    /// @brief Writes the last snapshot, if still waiting, then stops
+    ~CheckpointWriter();
+
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    /// @brief Copy the state of seq_id in ctx and queue it for writing
+    /// Must be called from the thread that decodes on ctx, and only from it
+    /// @param tokens Tokens held by the sequence
+    /// @return false if the state could not be read
+    bool snapshot(llama_context* ctx,
+                  llama_seq_id seq_id,
+                  const std::vector<llama_token>& tokens);
+
+    /// @brief Wait until every queued snapshot is on disk
+    /// @return false if the last write failed
+    bool flush();
+
+    [[nodiscard]] const std::string& path() const { return path_; }
+
+  private:
+    struct Snapshot
+    {
+        std::vector<llama_token> tokens;
+        std::vector<uint8_t> state;
+    };
+
+    void run();
+
+    std::string path_;
+    CacheFileKey key_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    Snapshot front_;   // Written by the writer thread without the lock
+    Snapshot back_;    // Waiting to be written, swapped under the lock
+    Snapshot scratch_; // Filled by snapshot() without the lock
+    bool back_ready_ = false;
+    bool writing_ = false;
+    bool last_write_ok_ = true;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+} // namespace agent_cpp
@@ -82,6 +82,18 @@ class MCPError : public Error
     }
 };
 
+/// @brief A CancellationToken was cancelled
+/// Thrown by Model generation and Agent::run_loop at the next check after the
+/// token was cancelled. The conversation may end with a partial turn.
+class CancelledError : public Error
+{
+  public:
+    CancelledError()
+      : Error("operation cancelled")
+    {
+    }
+};
+
 /// @brief Exception to intentionally skip tool execution
 /// This is not an error condition - it's a control flow mechanism.
 /// Throw from before_tool_execution callback to skip a tool.
@@ -0,0 +1,139 @@
+#include "incremental_tokenizer.h"
+#include <algorithm>
+
+namespace agent_cpp {
+
+namespace {
+
+std::string
+token_piece(const llama_vocab* vocab, llama_token token)
+{
+    char buf[256];
+    int n = llama_token_to_piece(vocab, token, buf, sizeof(buf), 0, true);
+    if (n >= 0) {
+        return std::string(buf, n);
+    }
+
+    std::string piece(-n, '\0');
+    n = llama_token_to_piece(vocab, token, piece.data(), piece.size(), 0, true);
+    return n >= 0 ? piece.substr(0, n) : std::string();
+}
+
+} // anonymous namespace
+
+const std::vector<llama_token>&
+IncrementalTokenizer::tokenize(const llama_vocab* vocab,
+                               const std::string& prompt,
+                               bool add_special)
+{
+    // Find how many cached tokens still describe the start of the prompt
+    size_t keep = 0;
+    if (offsets_valid_ && vocab == vocab_ && add_special == add_special_) {
+        const size_t n = std::min(prompt.size(), prompt_.size());
+        size_t common = 0;
+        while (common < n && prompt[common] == prompt_[common]) {
+            common++;
+        }
+
+        for (size_t k = tokens_.size(); k > 0; k--) {
+            if (offsets_[k - 1] <= common &&
+                llama_vocab_is_control(vocab, tokens_[k - 1])) {
+                keep = k;
+                break;
+            }
+        }
+    }
+
+    tokens_.resize(keep);
+    offsets_.resize(keep);
+    prompt_ = prompt;
+    vocab_ = vocab;
+    add_special_ = add_special;
+    offsets_valid_ = false;
+
+    // An EOS added after the text would sit behind the changing tail
+    if (add_special && llama_vocab_get_add_eos(vocab)) {
+        tokens_.clear();
+        offsets_.clear();
+        const int n_tokens = -llama_tokenize(
+          vocab, prompt.c_str(), prompt.size(), nullptr, 0, true, true);
+        tokens_.resize(n_tokens);
+        if (llama_tokenize(vocab,
+                           prompt.c_str(),
+                           prompt.size(),
+                           tokens_.data(),
+                           tokens_.size(),
+                           true,
+                           true) < 0) {
+            reset();
+        }
+        return tokens_;
+    }
+
+    if (keep == 0 && add_special && llama_vocab_get_add_bos(vocab)) {
+        tokens_.push_back(llama_vocab_bos(vocab));
+        offsets_.push_back(0);
+    }
+
+    const size_t start = keep > 0 ? offsets_[keep - 1] : 0;
+    if (!append_tokens(vocab, prompt.substr(start), start)) {
+        reset();
+    }
+    return tokens_;
+}
+
+void
+IncrementalTokenizer::reset()
+{
+    prompt_.clear();
+    tokens_.clear();
+    offsets_.clear();
+    vocab_ = nullptr;
+    offsets_valid_ = false;
+}
+
+bool
+IncrementalTokenizer::append_tokens(const llama_vocab* vocab,
+                                    const std::string& text,
+                                    size_t base_offset)
+{
+    if (text.empty()) {
+        offsets_valid_ = base_offset == prompt_.size();
+        return true;
+    }
+
+    const int n_tokens =
+      -llama_tokenize(vocab, text.c_str(), text.size(), nullptr, 0, false, true);
+    std::vector<llama_token> tail(n_tokens);
+    if (llama_tokenize(vocab,
+                       text.c_str(),
+                       text.size(),
+                       tail.data(),
+                       tail.size(),
+                       false,
+                       true) < 0) {
+        return false;
+    }
+
+    // Record where each token ends, checking that the pieces reproduce the
+    // prompt; otherwise offsets cannot be trusted for the next call
+    bool valid = true;
+    size_t pos = base_offset;
+    tokens_.reserve(tokens_.size() + tail.size());
+    offsets_.reserve(offsets_.size() + tail.size());
+    for (llama_token token : tail) {
+        if (valid) {
+            const std::string piece = token_piece(vocab, token);
+            valid = pos + piece.size() <= prompt_.size() &&
+                    prompt_.compare(pos, piece.size(), piece) == 0;
+            pos += piece.size();
+        }
+        tokens_.push_back(token);
+        offsets_.push_back(pos);
+    }
+
+    offsets_valid_ = valid && pos == prompt_.size();
+    return true;
+}
+
+} // namespace agent_cpp
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "llama.h"
+#include <string>
+#include <vector>
+
+namespace agent_cpp {
+
+/// @brief Tokenizer that only re-tokenizes the changed tail of a prompt.
+///
+/// Keeps the last prompt of one conversation together with its tokens and the
+/// byte offset where each token ends. For the next prompt it finds the common
+/// prefix with the previous one, keeps every cached token up to the last
+/// control token (e.g. an end-of-message marker) inside that prefix, and only
+/// tokenizes the text after it. With special-token parsing the text after a
+/// control token is tokenized independently of what precedes it, so the
+/// result is identical to tokenizing the full prompt.
+///
+/// If earlier text changed, less of the cache matches and more is
+/// re-tokenized, down to a full tokenization. Vocabularies whose pieces do not
+/// reproduce the prompt byte-for-byte always take the full path.
+class IncrementalTokenizer
+{
+  public:
+    /// @brief Tokenize a prompt, reusing tokens from the previous call
+    /// @param vocab Vocabulary used for tokenization
+    /// @param prompt Full rendered prompt
+    /// @param add_special Whether to add BOS (as in llama_tokenize)
+    /// @return Tokens of the full prompt; empty on failure
+    const std::vector<llama_token>& tokenize(const llama_vocab* vocab,
+                                             const std::string& prompt,
+                                             bool add_special);
+
+    /// @brief Forget the cached prompt
+    void reset();
+
+  private:
+    // Tokenize text without BOS/EOS, appending tokens and their end offsets
+    // (relative to base_offset). Returns false on failure.
+    bool append_tokens(const llama_vocab* vocab,
+                       const std::string& text,
+                       size_t base_offset);
+
+    std::string prompt_;
+    std::vector<llama_token> tokens_;
+    std::vector<size_t> offsets_; // Byte offset in prompt_ where each token ends
+    const llama_vocab* vocab_ = nullptr;
+    bool add_special_ = false;
+    bool offsets_valid_ = false; // Pieces reproduce prompt_ exactly
+};
+
+} // namespace agent_cpp
@@ -0,0 +1,781 @@
+#include "inference_engine.h"
+#include "chat.h"
+#include "common.h"
+#include "error.h"
+#include "stream_buffer.h"
+#include "tool_call_stream.h"
+#include <algorithm>
+#include <chrono>
+
+namespace agent_cpp {
+
+namespace {
+
+// How often a waiting session checks its cancellation token
+constexpr std::chrono::milliseconds CANCELLATION_POLL_INTERVAL{ 20 };
+
+double
+elapsed_ms(std::chrono::steady_clock::time_point start,
+           std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+size_t
+common_prefix_length(const std::vector<llama_token>& a,
+                     const std::vector<llama_token>& b)
+{
+    size_t n = 0;
+    while (n < a.size() && n < b.size() && a[n] == b[n]) {
+        n++;
+    }
+    return n;
+}
+
+} // anonymous namespace
+
+std::shared_ptr<InferenceEngine>
+InferenceEngine::create(std::shared_ptr<ModelWeights> weights,
+                        const ModelConfig& model_config,
+                        int n_sessions,
+                        int n_prefixes)
+{
+    if (n_sessions < 1) {
+        throw ModelError("engine requires at least one session");
+    }
+    if (n_prefixes < 0) {
+        throw ModelError("number of shared prefixes must not be negative");
+    }
+
+    std::shared_ptr<InferenceEngine> engine(new InferenceEngine());
+    engine->weights_ = std::move(weights);
+    engine->config_ = model_config;
+    engine->initialize_context(n_sessions, n_prefixes);
+    engine->worker_ = std::thread(&InferenceEngine::run, engine.get());
+    return engine;
+}
+
+InferenceEngine::~InferenceEngine()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+
+    for (auto& slot : slots_) {
+        if (slot.sampler != nullptr) {
+            llama_sampler_free(slot.sampler);
+        }
+        if (slot.request_sampler != nullptr) {
+            llama_sampler_free(slot.request_sampler);
+        }
+    }
+    if (batch_.token != nullptr) {
+        llama_batch_free(batch_);
+    }
+    if (ctx_ != nullptr) {
+        llama_free(ctx_);
+    }
+}
+
+void
+InferenceEngine::initialize_context(int n_sessions, int n_prefixes)
+{
+    // All sequences share one unified KV cache, so a forked prefix occupies
+    // its cells once; each sequence is limited to n_ctx tokens by the
+    // scheduler rather than by a fixed partition.
+    const int n_seq = n_sessions + n_prefixes;
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = config_.n_ctx * n_seq;
+    ctx_params.n_batch = config_.n_batch;
+    ctx_params.n_seq_max = n_seq;
+    ctx_params.kv_unified = true;
+    ctx_params.n_threads = config_.n_threads;
+    ctx_params.n_threads_batch = config_.n_threads_batch;
+    ctx_params.type_k = config_.cache_type_k;
+    ctx_params.type_v = config_.cache_type_v;
+    ctx_params.flash_attn_type = config_.flash_attn;
+
+    ctx_ = llama_init_from_model(weights_->get_model(), ctx_params);
+    if (ctx_ == nullptr) {
+        throw ModelError("failed to create llama context");
+    }
+
+    n_ctx_slot_ = config_.n_ctx;
+    batch_ = llama_batch_init(static_cast<int32_t>(llama_n_batch(ctx_)), 0, 1);
+
+    n_sessions_ = n_sessions;
+    slots_.resize(n_seq);
+    for (int i = 0; i < n_seq; i++) {
+        slots_[i].seq_id = i;
+        slots_[i].is_prefix = i >= n_sessions;
+        slots_[i].sampler = make_sampler_chain(config_, weights_->get_vocab());
+    }
+}
+
+std::shared_ptr<EngineSession>
+InferenceEngine::create_session()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < n_sessions_; i++) {
+        if (!slots_[i].in_use) {
+            slots_[i].in_use = true;
+            return std::shared_ptr<EngineSession>(
+              new EngineSession(shared_from_this(), static_cast<int>(i)));
+        }
+    }
+    throw ModelError("no free session in inference engine");
+}
+
+bool
+InferenceEngine::has_work() const
+{
+    return std::any_of(slots_.begin(), slots_.end(), [](const Slot& slot) {
+        return slot.request != nullptr;
+    });
+}
+
+void
+InferenceEngine::begin_request(Slot& slot)
+{
+    const auto& tokens = slot.request->tokens;
+    llama_memory_t mem = llama_get_memory(ctx_);
+
+    // Reuse the longest common prefix already in this sequence's KV cache
+    size_t common_prefix = common_prefix_length(slot.processed, tokens);
+
+    // A shared prefix that covers more of the prompt is forked instead
+    Slot* source = nullptr;
+    size_t shared_prefix = common_prefix;
+    if (!slot.is_prefix) {
+        for (auto& other : slots_) {
+            if (!other.is_prefix || other.request) {
+                continue;
+            }
+            const size_t n = common_prefix_length(other.processed, tokens);
+            if (n > shared_prefix) {
+                shared_prefix = n;
+                source = &other;
+            }
+        }
+    }
+
+    // At least one prompt token must be decoded to get fresh logits
+    shared_prefix = std::min(shared_prefix, tokens.size() - 1);
+    common_prefix = std::min(common_prefix, tokens.size() - 1);
+
+    if (source != nullptr && shared_prefix > common_prefix) {
+        llama_memory_seq_rm(mem, slot.seq_id, -1, -1);
+        llama_memory_seq_cp(mem, source->seq_id, slot.seq_id, 0, shared_prefix);
+        slot.processed.assign(tokens.begin(), tokens.begin() + shared_prefix);
+        source->last_used = ++use_clock_;
+        common_prefix = shared_prefix;
+    } else if (common_prefix < slot.processed.size()) {
+        llama_memory_seq_rm(mem, slot.seq_id, common_prefix, -1);
+        slot.processed.resize(common_prefix);
+    }
+
+    slot.started = true;
+    slot.n_prompt_done = common_prefix;
+    slot.has_next = false;
+    // Penalty and mirostat state must not carry over from the last turn
+    llama_sampler_reset(slot.sampler);
+    if (slot.request->sampling) {
+        slot.request_sampler =
+          make_sampler_chain(*slot.request->sampling, weights_->get_vocab());
+    }
+
+    auto& stats = slot.request->stats;
+    stats.n_prompt_tokens = static_cast<int>(tokens.size());
+    stats.n_cached_tokens = static_cast<int>(common_prefix);
+    stats.n_prefill_tokens = stats.n_prompt_tokens - stats.n_cached_tokens;
+}
+
+void
+InferenceEngine::finish_request(Slot& slot, const std::string& error)
+{
+    auto& request = *slot.request;
+    if (request.prefilled != std::chrono::steady_clock::time_point{}) {
+        request.stats.prefill_ms =
+          elapsed_ms(request.submitted, request.prefilled);
+        request.stats.decode_ms =
+          elapsed_ms(request.prefilled, std::chrono::steady_clock::now());
+    }
+
+    slot.request->error = error;
+    slot.request->done = true;
+    slot.request->cv.notify_all();
+    slot.request.reset();
+    if (slot.request_sampler != nullptr) {
+        llama_sampler_free(slot.request_sampler);
+        slot.request_sampler = nullptr;
+    }
+    slot.started = false;
+    slot.has_next = false;
+    slot.i_batch = -1;
+    slot.n_batch_tokens = 0;
+}
+
+void
+InferenceEngine::run()
+{
+    const llama_vocab* vocab = weights_->get_vocab();
+    const int n_batch = static_cast<int>(llama_n_batch(ctx_));
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        work_cv_.wait(lock, [this] { return stopping_ || has_work(); });
+        if (stopping_) {
+            break;
+        }
+
+        common_batch_clear(batch_);
+
+        for (auto& slot : slots_) {
+            slot.i_batch = -1;
+            slot.n_batch_tokens = 0;
+            if (!slot.request) {
+                continue;
+            }
+            if (slot.request->cancelled) {
+                finish_request(slot);
+                continue;
+            }
+            if (!slot.started) {
+                if (slot.request->tokens.empty()) {
+                    finish_request(slot, "empty prompt");
+                    continue;
+                }
+                if (slot.request->tokens.size() >
+                    static_cast<size_t>(n_ctx_slot_)) {
+                    finish_request(slot, "context size exceeded");
+                    continue;
+                }
+                begin_request(slot);
+            }
+        }
+
+        // Decode tokens go first so generating sessions are never starved by
+        // long prompts. With more generating sessions than n_batch, the rest
+        // wait for the next step; the rotating start keeps that fair.
+        for (size_t k = 0; k < slots_.size() && batch_.n_tokens < n_batch;
+             k++) {
+            auto& slot = slots_[(next_slot_ + k) % slots_.size()];
+            if (!slot.request || !slot.has_next) {
+                continue;
+            }
+            if (slot.processed.size() + 1 > static_cast<size_t>(n_ctx_slot_)) {
+                finish_request(slot, "context size exceeded during generation");
+                continue;
+            }
+            slot.i_batch = batch_.n_tokens;
+            common_batch_add(batch_,
+                             slot.next_token,
+                             static_cast<llama_pos>(slot.processed.size()),
+                             { slot.seq_id },
+                             true);
+            slot.n_batch_tokens = 1;
+        }
+
+        // Fill the remaining batch with prompt chunks, rotating the starting
+        // slot so concurrent prefills share the budget fairly
+        for (size_t k = 0; k < slots_.size() && batch_.n_tokens < n_batch;
+             k++) {
+            auto& slot = slots_[(next_slot_ + k) % slots_.size()];
+            if (!slot.request || slot.has_next) {
+                continue;
+            }
+
+            const auto& tokens = slot.request->tokens;
+            const size_t remaining = tokens.size() - slot.n_prompt_done;
+            const size_t n_take = std::min(
+              remaining, static_cast<size_t>(n_batch - batch_.n_tokens));
+
+            for (size_t j = 0; j < n_take; j++) {
+                const size_t idx = slot.n_prompt_done + j;
+                const bool is_last = idx + 1 == tokens.size();
+                if (is_last) {
+                    slot.i_batch = batch_.n_tokens;
+                }
+                common_batch_add(batch_,
+                                 tokens[idx],
+                                 static_cast<llama_pos>(slot.processed.size() + j),
+                                 { slot.seq_id },
+                                 is_last);
+            }
+            slot.n_batch_tokens = static_cast<int>(n_take);
+        }
+        next_slot_ = (next_slot_ + 1) % slots_.size();
+
+        if (batch_.n_tokens == 0) {
+            continue;
+        }
+
+        decoding_ = true;
+        lock.unlock();
+        const int ret = llama_decode(ctx_, batch_);
+        lock.lock();
+        decoding_ = false;
+        idle_cv_.notify_all();
+
+        for (auto& slot : slots_) {
+            if (!slot.request || slot.n_batch_tokens == 0) {
+                continue;
+            }
+
+            if (ret != 0) {
+                // Drop whatever part of the batch may have reached the cache
+                llama_memory_seq_rm(llama_get_memory(ctx_),
+                                    slot.seq_id,
+                                    static_cast<llama_pos>(slot.processed.size()),
+                                    -1);
+                finish_request(slot, "failed to decode batch");
+                continue;
+            }
+
+            if (slot.has_next) {
+                slot.processed.push_back(slot.next_token);
+                slot.has_next = false;
+            } else {
+                const auto& tokens = slot.request->tokens;
+                slot.processed.insert(
+                  slot.processed.end(),
+                  tokens.begin() + slot.n_prompt_done,
+                  tokens.begin() + slot.n_prompt_done + slot.n_batch_tokens);
+                slot.n_prompt_done += slot.n_batch_tokens;
+                if (slot.n_prompt_done == tokens.size()) {
+                    slot.request->prefilled = std::chrono::steady_clock::now();
+                }
+            }
+
+            if (slot.i_batch < 0) {
+                continue; // Prompt still being ingested
+            }
+
+            if (slot.request->prefill_only) {
+                finish_request(slot);
+                continue;
+            }
+
+            llama_sampler* sampler = slot.request_sampler != nullptr
+                                       ? slot.request_sampler
+                                       : slot.sampler;
+            const llama_token token_id =
+              llama_sampler_sample(sampler, ctx_, slot.i_batch);
+
+            if (llama_vocab_is_eog(vocab, token_id)) {
+                finish_request(slot);
+                continue;
+            }
+
+            slot.request->pending.append(weights_->token_to_piece(token_id));
+            auto& stats = slot.request->stats;
+            if (stats.n_generated_tokens++ == 0) {
+                stats.ttft_ms = elapsed_ms(slot.request->submitted,
+                                           std::chrono::steady_clock::now());
+            }
+            slot.request->cv.notify_all();
+            slot.next_token = token_id;
+            slot.has_next = true;
+        }
+    }
+
+    // Fail anything still in flight so callers do not wait forever
+    for (auto& slot : slots_) {
+        if (slot.request) {
+            finish_request(slot, "inference engine stopped");
+        }
+    }
+}
+
+std::shared_ptr<InferenceEngine::Request>
+InferenceEngine::submit(int slot_index,
+                        const std::vector<llama_token>& tokens,
+                        const std::optional<SamplingParams>& sampling)
+{
+    auto request = std::make_shared<Request>();
+    request->tokens = tokens;
+    request->sampling = sampling;
+    request->submitted = std::chrono::steady_clock::now();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            throw ModelError("inference engine stopped");
+        }
+        auto& slot = slots_[slot_index];
+        if (slot.request) {
+            throw ModelError("session is already generating");
+        }
+        slot.request = request;
+    }
+    work_cv_.notify_one();
+    return request;
+}
+
+bool
+InferenceEngine::share_prefix(const std::vector<llama_token>& tokens)
+{
+    if (tokens.empty()) {
+        return false;
+    }
+
+    auto request = std::make_shared<Request>();
+    request->tokens = tokens;
+    request->submitted = std::chrono::steady_clock::now();
+    request->prefill_only = true;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopping_) {
+            throw ModelError("inference engine stopped");
+        }
+
+        // Already shared: just mark it as recently used
+        for (int i = n_sessions_; i < static_cast<int>(slots_.size()); i++) {
+            auto& slot = slots_[i];
+            if (!slot.request && slot.processed == tokens) {
+                slot.last_used = ++use_clock_;
+                return true;
+            }
+        }
+
+        // Pick an empty prefix sequence, or replace the least recently used
+        Slot* target = nullptr;
+        for (int i = n_sessions_; i < static_cast<int>(slots_.size()); i++) {
+            auto& slot = slots_[i];
+            if (slot.request) {
+                continue;
+            }
+            if (target == nullptr || slot.processed.empty() ||
+                (!target->processed.empty() &&
+                 slot.last_used < target->last_used)) {
+                target = &slot;
+            }
+        }
+        if (target == nullptr) {
+            return false;
+        }
+
+        target->last_used = ++use_clock_;
+        target->request = request;
+    }
+    work_cv_.notify_one();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    request->cv.wait(lock, [&request] { return request->done; });
+    if (!request->error.empty()) {
+        throw ModelError(request->error);
+    }
+    return true;
+}
+
+void
+InferenceEngine::cancel(const std::shared_ptr<Request>& request)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (request->done) {
+        return;
+    }
+    request->cancelled = true;
+    work_cv_.notify_one();
+    request->cv.wait(lock, [&request] { return request->done; });
+}
+
+void
+InferenceEngine::with_context(int slot_index,
+                              const std::function<void(Slot&)>& fn)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_cv_.wait(lock, [this] { return !decoding_; });
+    fn(slots_[slot_index]);
+}
+
+void
+InferenceEngine::release(int slot_index)
+{
+    std::shared_ptr<Request> request;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        request = slots_[slot_index].request;
+    }
+    if (request) {
+        cancel(request);
+    }
+
+    with_context(slot_index, [this](Slot& slot) {
+        llama_memory_seq_rm(llama_get_memory(ctx_), slot.seq_id, -1, -1);
+        llama_sampler_reset(slot.sampler);
+        slot.processed.clear();
+        slot.in_use = false;
+    });
+}
+
+EngineSession::~EngineSession()
+{
+    engine_->release(slot_index_);
+}
+
+llama_seq_id
+EngineSession::get_seq_id() const
+{
+    return engine_->slots_[slot_index_].seq_id;
+}
+
+bool
+EngineSession::is_empty() const
+{
+    std::lock_guard<std::mutex> lock(engine_->mutex_);
+    return engine_->slots_[slot_index_].processed.empty();
+}
+
+std::vector<llama_token>
+EngineSession::tokenize(const std::string& prompt) const
+{
+    const llama_vocab* vocab = engine_->get_weights()->get_vocab();
+
+    // Same BOS handling as Model::tokenize: only a prompt for an empty
+    // sequence is tokenized as the first one
+    const bool is_first = is_empty();
+
+    const int n_prompt_tokens = -llama_tokenize(
+      vocab, prompt.c_str(), prompt.size(), nullptr, 0, is_first, true);
+    std::vector<llama_token> prompt_tokens(n_prompt_tokens);
+    if (llama_tokenize(vocab,
+                       prompt.c_str(),
+                       prompt.size(),
+                       prompt_tokens.data(),
+                       prompt_tokens.size(),
+                       is_first,
+                       true) < 0) {
+        return {};
+    }
+    return prompt_tokens;
+}
+
+common_chat_msg
+EngineSession::generate(const std::vector<common_chat_msg>& messages,
+                        const std::vector<common_chat_tool>& tools,
+                        const ResponseCallback& callback,
+                        const GenerateOptions& options)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    common_chat_templates_inputs inputs;
+    inputs.messages = messages;
+    inputs.tools = tools;
+    inputs.tool_choice = COMMON_CHAT_TOOL_CHOICE_AUTO;
+    inputs.add_generation_prompt = true;
+    inputs.enable_thinking = false;
+
+    auto params = common_chat_templates_apply(get_templates(), inputs);
+
+    const std::vector<llama_token>& prompt_tokens = prompt_tokenizer_.tokenize(
+      engine_->get_weights()->get_vocab(), params.prompt, is_empty());
+    if (prompt_tokens.empty()) {
+        throw ModelError("failed to tokenize prompt");
+    }
+    const double prompt_ms =
+      elapsed_ms(start, std::chrono::steady_clock::now());
+
+    common_chat_syntax syntax;
+    syntax.format = engine_->get_config().chat_format.value_or(params.format);
+    syntax.parse_tool_calls = true;
+
+    std::string response;
+    if (options.on_tool_call && !tools.empty()) {
+        ToolCallStream stream(syntax, callback, options.on_tool_call);
+        response = generate_from_tokens(prompt_tokens,
+                                        stream.as_callback(),
+                                        options.cancellation,
+                                        options.sampling);
+    } else {
+        response = generate_from_tokens(
+          prompt_tokens, callback, options.cancellation, options.sampling);
+    }
+
+    stats_.prompt_ms = prompt_ms;
+    if (stats_.n_generated_tokens > 0) {
+        stats_.ttft_ms += prompt_ms;
+    }
+    if (options.stats != nullptr) {
+        *options.stats = stats_;
+    }
+
+    auto parsed_msg = common_chat_parse(response, false, syntax);
+    parsed_msg.role = "assistant";
+
+    return parsed_msg;
+}
+
+std::string
+EngineSession::generate_from_tokens(const std::vector<llama_token>& all_tokens,
+                                    const ResponseCallback& callback)
+{
+    return generate_from_tokens(all_tokens, callback, nullptr);
+}
+
+std::string
+EngineSession::generate_from_tokens(
+  const std::vector<llama_token>& all_tokens,
+  const ResponseCallback& callback,
+  const std::shared_ptr<CancellationToken>& cancellation,
+  const std::optional<SamplingParams>& sampling)
+{
+    auto request = engine_->submit(slot_index_, all_tokens, sampling);
+
+    const ModelConfig& config = engine_->get_config();
+    StreamBuffer stream(callback,
+                        config.stream_min_bytes,
+                        std::chrono::milliseconds(config.stream_max_delay_ms));
+    std::string response{};
+    std::unique_lock<std::mutex> lock(engine_->mutex_);
+    while (true) {
+        auto ready = [&request] {
+            return request->done || !request->pending.empty();
+        };
+        if (cancellation) {
+            // Nothing signals the request when the token is cancelled, so
+            // poll it while waiting
+            request->cv.wait_for(lock, CANCELLATION_POLL_INTERVAL, ready);
+            if (cancellation->is_cancelled()) {
+                lock.unlock();
+                engine_->cancel(request);
+                throw CancelledError();
+            }
+            if (!ready()) {
+                continue;
+            }
+        } else {
+            request->cv.wait(lock, ready);
+        }
+
+        std::string chunk = std::move(request->pending);
+        request->pending.clear();
+        const bool done = request->done;
+        const std::string error = request->error;
+        if (done) {
+            stats_ = request->stats;
+        }
+        lock.unlock();
+
+        try {
+            stream.add(chunk);
+            if (done && error.empty()) {
+                stream.flush();
+            }
+        } catch (...) {
+            engine_->cancel(request);
+            throw;
+        }
+        response += chunk;
+
+        if (done) {
+            if (!error.empty()) {
+                throw ModelError(error);
+            }
+            return response;
+        }
+        lock.lock();
+    }
+}
+
+bool
+EngineSession::save_cache(const std::string& cache_path, uint64_t tools_hash)
+{
+    const CacheFileKey key =
+      engine_->weights_->cache_key(engine_->config_, tools_hash);
+    bool ok = false;
+    engine_->with_context(
+      slot_index_, [this, &cache_path, &key, &ok](auto& slot) {
+          ok = CacheFile::save(cache_path,
+                               key,
+                               engine_->ctx_,
+                               { { slot.seq_id, &slot.processed } });
+      });
+    return ok;
+}
+
+std::vector<llama_token>
+EngineSession::load_cache(const std::string& cache_path, uint64_t tools_hash)
+{
+    auto file = CacheFile::open(
+      cache_path, engine_->weights_->cache_key(engine_->config_, tools_hash));
+    if (!file || file->n_sequences() != 1) {
+        return {};
+    }
+    std::vector<llama_token> tokens = file->tokens(0);
+    if (tokens.size() > static_cast<size_t>(engine_->n_ctx_slot_)) {
+        return {};
+    }
+
+    bool ok = false;
+    engine_->with_context(slot_index_, [this, &file, &tokens, &ok](auto& slot) {
+        if (slot.request) {
+            return; // Never swap the KV cache under an active request
+        }
+        llama_memory_seq_rm(llama_get_memory(engine_->ctx_), slot.seq_id, -1, -1);
+        ok = file->load_sequence(0, engine_->ctx_, slot.seq_id);
+        slot.processed = ok ? tokens : std::vector<llama_token>{};
+    });
+
+    if (!ok) {
+        return {};
+    }
+    return tokens;
+}
+
+std::optional<SequenceState>
+EngineSession::export_state()
+{
+    std::optional<SequenceState> state;
+    engine_->with_context(slot_index_, [this, &state](auto& slot) {
+        if (slot.request) {
+            return;
+        }
+        SequenceState exported;
+        exported.key = engine_->weights_->cache_key(engine_->config_, 0);
+        exported.tokens = slot.processed;
+        exported.data.resize(
+          llama_state_seq_get_size(engine_->ctx_, slot.seq_id));
+        const size_t n_written = llama_state_seq_get_data(engine_->ctx_,
+                                                          exported.data.data(),
+                                                          exported.data.size(),
+                                                          slot.seq_id);
+        if (n_written > 0) {
+            exported.data.resize(n_written);
+            state = std::move(exported);
+        }
+    });
+    return state;
+}
+
+bool
+EngineSession::import_state(const SequenceState& state)
+{
+    if (state.key != engine_->weights_->cache_key(engine_->config_, 0) ||
+        state.tokens.size() > static_cast<size_t>(engine_->n_ctx_slot_)) {
+        return false;
+    }
+
+    bool ok = false;
+    engine_->with_context(slot_index_, [this, &state, &ok](auto& slot) {
+        if (slot.request) {
+            return; // Never swap the KV cache under an active request
+        }
+        llama_memory_seq_rm(
+          llama_get_memory(engine_->ctx_), slot.seq_id, -1, -1);
+        ok = llama_state_seq_set_data(engine_->ctx_,
+                                      state.data.data(),
+                                      state.data.size(),
+                                      slot.seq_id) > 0;
+        slot.processed = ok ? state.tokens : std::vector<llama_token>{};
+    });
+    return ok;
+}
+
+} // namespace agent_cpp
@@ -0,0 +1,272 @@
+#pragma once
+
+#include "chat.h"
+#include "incremental_tokenizer.h"
+#include "llama.h"
+#include "model.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace agent_cpp {
+
+class EngineSession;
+
+/// @brief Shared inference engine serving many sessions from one context.
+///
+/// InferenceEngine owns a single llama_context over shared ModelWeights and a
+/// worker thread that performs continuous batching: every step packs the next
+/// decode token of each generating session and as many pending prompt tokens
+/// as fit in n_batch into one multi-sequence llama_batch (one seq_id per
+/// session), so N concurrent agents share one llama_decode call per step
+/// instead of issuing N small ones.
+///
+/// Sessions are created with create_session() and implement IModel, so they
+/// can be handed to an Agent exactly like a Model.
+///
+/// Prompt prefixes shared by many sessions (system prompt + tool definitions)
+/// can be prefilled once with share_prefix(); a session whose prompt starts
+/// with a shared prefix forks it into its own sequence with
+/// llama_memory_seq_cp instead of decoding it again.
+class InferenceEngine : public std::enable_shared_from_this<InferenceEngine>
+{
+    friend class EngineSession;
+
+  public:
+    /// @brief Create an engine over shared weights
+    /// @param weights Shared pointer to ModelWeights
+    /// @param model_config Sampling and context configuration. n_ctx is the
+    /// context size available to each session.
+    /// @param n_sessions Maximum number of concurrent sessions
+    /// @param n_prefixes Number of sequences reserved for shared prefixes
+    /// @return Shared pointer to the running engine
+    /// @throws agent_cpp::ModelError if context creation fails
+    static std::shared_ptr<InferenceEngine> create(
+      std::shared_ptr<ModelWeights> weights,
+      const ModelConfig& model_config = ModelConfig{},
+      int n_sessions = 4,
+      int n_prefixes = 1);
+
+    // Stops the worker thread and frees the context
+    ~InferenceEngine();
+
+    InferenceEngine(const InferenceEngine&) = delete;
+    InferenceEngine& operator=(const InferenceEngine&) = delete;
+    InferenceEngine(InferenceEngine&&) = delete;
+    InferenceEngine& operator=(InferenceEngine&&) = delete;
+
+    /// @brief Create a session bound to a free sequence of the shared context
+    /// @return Shared pointer to the new session
+    /// @throws agent_cpp::ModelError if all sequences are in use
+    std::shared_ptr<EngineSession> create_session();
+
+    /// @brief Prefill a prompt prefix once so sessions can fork it
+    /// @param tokens Prefix tokens (typically system prompt + tools)
+    /// @return true if the prefix is available to sessions, false if every
+    /// prefix sequence is busy
+    /// @throws agent_cpp::ModelError if decoding the prefix fails
+    ///
+    /// When all prefix sequences are taken, the least recently used prefix
+    /// is replaced. Sessions that already forked it keep their copy.
+    bool share_prefix(const std::vector<llama_token>& tokens);
+
+    /// @brief Maximum number of concurrent sessions
+    [[nodiscard]] int n_sessions() const { return n_sessions_; }
+
+    /// @brief Get the shared weights
+    [[nodiscard]] std::shared_ptr<ModelWeights> get_weights() const
+    {
+        return weights_;
+    }
+
+    /// @brief Get the configuration used by every session
+    [[nodiscard]] const ModelConfig& get_config() const { return config_; }
+
+  private:
+    // One generation call submitted by a session, shared with the worker
+    struct Request
+    {
+        std::vector<llama_token> tokens; // Full prompt
+        std::string pending;             // Pieces not yet handed to the caller
+        std::string error;               // Set when the request failed
+        bool done = false;
+        bool cancelled = false;
+        bool prefill_only = false; // Finish once the prompt is in the cache
+        std::optional<SamplingParams> sampling; // Overrides the engine config
+        std::condition_variable cv;
+        GenerationStats stats; // Filled in by the worker
+        std::chrono::steady_clock::time_point submitted;
+        std::chrono::steady_clock::time_point prefilled; // Prompt in cache
+    };
+
+    // Per-sequence state, owned by the worker while a request is active
+    struct Slot
+    {
+        llama_seq_id seq_id = 0;
+        bool in_use = false;
+        bool is_prefix = false; // Holds a shared prefix, not a session
+        uint64_t last_used = 0;
+        llama_sampler* sampler = nullptr;
+        llama_sampler* request_sampler = nullptr; // For Request::sampling
+        std::vector<llama_token> processed; // Tokens in this sequence's KV
+        std::shared_ptr<Request> request;
+        bool started = false;      // Prefix matched against processed
+        size_t n_prompt_done = 0;  // Prompt tokens already in the KV cache
+        bool has_next = false;     // next_token is sampled but not decoded
+        llama_token next_token = 0;
+        int n_batch_tokens = 0; // Tokens this slot added to the current batch
+        int i_batch = -1;       // Logits index in the current batch
+    };
+
+    InferenceEngine() = default;
+
+    void initialize_context(int n_sessions, int n_prefixes);
+    void run();
+    [[nodiscard]] bool has_work() const;
+    void begin_request(Slot& slot);
+    void finish_request(Slot& slot, const std::string& error = {});
+
+    // Session-facing operations (called from caller threads)
+    std::shared_ptr<Request> submit(
+      int slot_index,
+      const std::vector<llama_token>& tokens,
+      const std::optional<SamplingParams>& sampling = std::nullopt);
+    void cancel(const std::shared_ptr<Request>& request);
+    void release(int slot_index);
+
+    // Run fn with exclusive access to the context (no decode in flight)
+    void with_context(int slot_index, const std::function<void(Slot&)>& fn);
+
+    std::shared_ptr<ModelWeights> weights_;
+    ModelConfig config_;
+    llama_context* ctx_ = nullptr;
+    llama_batch batch_{};
+    int n_ctx_slot_ = 0;
+    int n_sessions_ = 0;
+    std::vector<Slot> slots_; // Sessions first, then shared prefixes
+    uint64_t use_clock_ = 0;
+    size_t next_slot_ = 0; // Round-robin start for prefill scheduling
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable idle_cv_;
+    bool decoding_ = false;
+    bool stopping_ = false;
+    std::thread worker_;
+};
+
+/// @brief A conversation running on a sequence of a shared InferenceEngine.
+///
+/// EngineSession behaves like a Model with its own KV cache (prefix reuse
+/// across turns, prompt caching), but its decode steps are batched with every
+/// other live session of the same engine. A session serves one generation
+/// call at a time.
+class EngineSession : public IModel
+{
+    friend class InferenceEngine;
+
+  public:
+    // Releases the sequence back to the engine
+    ~EngineSession() override;
+
+    EngineSession(const EngineSession&) = delete;
+    EngineSession& operator=(const EngineSession&) = delete;
+    EngineSession(EngineSession&&) = delete;
+    EngineSession& operator=(EngineSession&&) = delete;
+
+    // Generate text from chat messages and tools
+    // Applies chat templates, tokenizes, and generates response
+    // Returns parsed message with role set to "assistant"
+    common_chat_msg generate(const std::vector<common_chat_msg>& messages,
+                             const std::vector<common_chat_tool>& tools,
+                             const ResponseCallback& callback = nullptr,
+                             const GenerateOptions& options = {}) override;
+
+    // Generate text from pre-tokenized input, only processing new tokens
+    // Blocks until the engine finishes the request; the callback runs on the
+    // calling thread
+    std::string generate_from_tokens(
+      const std::vector<llama_token>& all_tokens,
+      const ResponseCallback& callback = nullptr) override;
+
+    // Tokenize a prompt string into tokens
+    // Returns empty vector on failure
+    std::vector<llama_token> tokenize(const std::string& prompt) const override;
+
+    [[nodiscard]] bool supports_prompt_cache() const override { return true; }
+
+    // Get the chat templates
+    [[nodiscard]] common_chat_templates* get_templates() const override
+    {
+        return engine_->get_weights()->get_templates();
+    }
+
+    // Get the sequence id this session occupies in the shared context
+    [[nodiscard]] llama_seq_id get_seq_id() const;
+
+    // Get the stats of the last generate or generate_from_tokens call
+    // prefill_ms includes time spent waiting for the shared batch
+    [[nodiscard]] const GenerationStats& get_last_stats() const
+    {
+        return stats_;
+    }
+
+    // Save this session's sequence of the KV cache to a CacheFile
+    // Returns true on success, false on failure
+    bool save_cache(const std::string& cache_path,
+                    uint64_t tools_hash = 0) override;
+
+    // Load a CacheFile sequence into this session
+    // Returns the tokens that were cached, or empty vector on failure
+    std::vector<llama_token> load_cache(const std::string& cache_path,
+                                        uint64_t tools_hash = 0) override;
+
+    [[nodiscard]] uint64_t cache_fingerprint() const override
+    {
+        return engine_->get_weights()
+          ->cache_key(engine_->get_config(), 0)
+          .hash();
+    }
+
+    // Export or replace this session's sequence; both fail while the
+    // session has a request running
+    std::optional<SequenceState> export_state() override;
+    bool import_state(const SequenceState& state) override;
+
+    // Prefill a prefix in the engine's shared prefix sequences
+    bool share_prefix(const std::vector<llama_token>& tokens) override
+    {
+        return engine_->share_prefix(tokens);
+    }
+
+  private:
+    EngineSession(std::shared_ptr<InferenceEngine> engine, int slot_index)
+      : engine_(std::move(engine))
+      , slot_index_(slot_index)
+    {
+    }
+
+    // Whether the session's sequence is empty (first prompt gets BOS)
+    [[nodiscard]] bool is_empty() const;
+
+    // generate_from_tokens that cancels the request once cancellation is set
+    // and samples with sampling instead of the engine config if it is set
+    std::string generate_from_tokens(
+      const std::vector<llama_token>& all_tokens,
+      const ResponseCallback& callback,
+      const std::shared_ptr<CancellationToken>& cancellation,
+      const std::optional<SamplingParams>& sampling = std::nullopt);
+
+    std::shared_ptr<InferenceEngine> engine_;
+    int slot_index_;
+    IncrementalTokenizer prompt_tokenizer_; // Last prompt and its tokens
+    GenerationStats stats_;                 // Of the last generate
+};
+
+} // namespace agent_cpp
@@ -2,6 +2,7 @@
 #include "error.h"
 #include "mcp/mcp_tool.h"
 
+#include <chrono>
 #include <sstream>
 
 #define CPPHTTPLIB_OPENSSL_SUPPORT
@@ -37,6 +38,7 @@ MCPClient::create(const std::string& url, const MCPClientConfig& config)
 
 MCPClient::MCPClient(const std::string& url, const MCPClientConfig& config)
   : url_(url)
+  , config_(config)
 {
     std::string host;
     parse_url(url, host, path_);
@@ -86,6 +88,29 @@ MCPClient::parse_response(const std::string& response)
 
 json
 MCPClient::send_request(const std::string& method, const json& params)
+{
+    if (!config_.on_request) {
+        return post_request(method, params);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&start]() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+          .count();
+    };
+    try {
+        json result = post_request(method, params);
+        config_.on_request(method, elapsed(), true);
+        return result;
+    } catch (...) {
+        config_.on_request(method, elapsed(), false);
+        throw;
+    }
+}
+
+json
+MCPClient::post_request(const std::string& method, const json& params)
 {
     std::lock_guard<std::mutex> lock(send_mutex_);
 
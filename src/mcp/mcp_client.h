@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -50,6 +51,11 @@ struct MCPClientConfig
     int connection_timeout_sec = 10;
     int read_timeout_sec = 30;
     int write_timeout_sec = 10;
+
+    // Called after each JSON-RPC request with its method, round-trip time in
+    // seconds and whether it succeeded, e.g. to record metrics
+    std::function<void(const std::string& method, double seconds, bool ok)>
+      on_request;
 };
 
 class MCPClient : public std::enable_shared_from_this<MCPClient>
@@ -84,6 +90,7 @@ class MCPClient : public std::enable_shared_from_this<MCPClient>
     std::string url_;
     std::string path_;
     std::unique_ptr<httplib::Client> http_client_;
+    MCPClientConfig config_;
 
     std::string session_id_;
     std::string protocol_version_;
@@ -98,6 +105,8 @@ class MCPClient : public std::enable_shared_from_this<MCPClient>
     json send_request(const std::string& method,
                       const json& params = json::object());
 
+    json post_request(const std::string& method, const json& params);
+
     void send_notification(const std::string& method,
                            const json& params = json::object());
 
@@ -0,0 +1,264 @@
+#include "metrics.h"
+#include "error.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace agent_cpp {
+
+namespace {
+
+std::string
+format_value(double value)
+{
+    if (std::isinf(value)) {
+        return value > 0 ? "+Inf" : "-Inf";
+    }
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.15g", value);
+    return buf;
+}
+
+std::string
+escape_label_value(const std::string& value)
+{
+    std::string out;
+    out.reserve(value.size());
+    for (char c : value) {
+        switch (c) {
+            case '\\':
+                out += "\\\\";
+                break;
+            case '"':
+                out += "\\\"";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            default:
+                out += c;
+        }
+    }
+    return out;
+}
+
+std::string
+escape_help(const std::string& help)
+{
+    std::string out;
+    out.reserve(help.size());
+    for (char c : help) {
+        if (c == '\\') {
+            out += "\\\\";
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+// {a="1",b="2"}, with an optional extra label such as le for buckets
+std::string
+format_labels(const MetricLabels& labels,
+              const char* extra_name = nullptr,
+              const std::string& extra_value = {})
+{
+    if (labels.empty() && extra_name == nullptr) {
+        return {};
+    }
+    std::string out = "{";
+    for (const auto& [name, value] : labels) {
+        if (out.size() > 1) {
+            out += ',';
+        }
+        out += name + "=\"" + escape_label_value(value) + '"';
+    }
+    if (extra_name != nullptr) {
+        if (out.size() > 1) {
+            out += ',';
+        }
+        out += std::string(extra_name) + "=\"" + extra_value + '"';
+    }
+    out += '}';
+    return out;
+}
+
+} // namespace
+
+Histogram::Histogram(std::vector<double> bounds)
+  : bounds_(std::move(bounds))
+  , counts_(new std::atomic<uint64_t>[bounds_.size() + 1])
+{
+    if (!std::is_sorted(bounds_.begin(), bounds_.end())) {
+        throw Error("Histogram bucket bounds must be ascending");
+    }
+    for (size_t i = 0; i <= bounds_.size(); i++) {
+        counts_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void
+Histogram::observe(double value)
+{
+    size_t i = std::lower_bound(bounds_.begin(), bounds_.end(), value) -
+               bounds_.begin();
+    counts_[i].fetch_add(1, std::memory_order_relaxed);
+
+    // std::atomic<double>::fetch_add is C++20
+    double sum = sum_.load(std::memory_order_relaxed);
+    while (!sum_.compare_exchange_weak(
+      sum, sum + value, std::memory_order_relaxed)) {
+    }
+    count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+const std::vector<double>&
+MetricsRegistry::default_seconds_buckets()
+{
+    static const std::vector<double> buckets = {
+        0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60
+    };
+    return buckets;
+}
+
+MetricsRegistry::Family&
+MetricsRegistry::family(const std::string& name,
+                        const std::string& help,
+                        bool is_histogram,
+                        const std::vector<double>& buckets)
+{
+    auto [it, inserted] = families_.try_emplace(name);
+    Family& family = it->second;
+    if (inserted) {
+        family.help = help;
+        family.is_histogram = is_histogram;
+        family.buckets = buckets;
+    } else if (family.is_histogram != is_histogram) {
+        throw Error("Metric '" + name + "' is already registered as a " +
+                    (family.is_histogram ? "histogram" : "counter"));
+    }
+    return family;
+}
+
+Counter&
+MetricsRegistry::counter(const std::string& name,
+                         const std::string& help,
+                         const MetricLabels& labels)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& series = family(name, help, false, {}).counters[labels];
+    if (!series) {
+        series = std::make_unique<Counter>();
+    }
+    return *series;
+}
+
+Histogram&
+MetricsRegistry::histogram(const std::string& name,
+                           const std::string& help,
+                           const std::vector<double>& buckets,
+                           const MetricLabels& labels)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Family& f = family(name, help, true, buckets);
+    auto& series = f.histograms[labels];
+    if (!series) {
+        series = std::make_unique<Histogram>(f.buckets);
+    }
+    return *series;
+}
+
+std::string
+MetricsRegistry::render() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string out;
+    for (const auto& [name, family] : families_) {
+        out += "# HELP " + name + ' ' + escape_help(family.help) + '\n';
+        out += "# TYPE " + name + ' ' +
+               (family.is_histogram ? "histogram" : "counter") + '\n';
+
+        for (const auto& [labels, counter] : family.counters) {
+            out += name + format_labels(labels) + ' ' +
+                   std::to_string(counter->value()) + '\n';
+        }
+
+        for (const auto& [labels, histogram] : family.histograms) {
+            // Derive the count from the buckets so that the series stays
+            // consistent while other threads observe
+            const auto& bounds = histogram->bounds();
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i < bounds.size(); i++) {
+                cumulative += histogram->bucket_count(i);
+                out += name + "_bucket" +
+                       format_labels(labels, "le", format_value(bounds[i])) +
+                       ' ' + std::to_string(cumulative) + '\n';
+            }
+            const uint64_t count =
+              cumulative + histogram->bucket_count(bounds.size());
+            out += name + "_bucket" + format_labels(labels, "le", "+Inf") +
+                   ' ' + std::to_string(count) + '\n';
+            out += name + "_sum" + format_labels(labels) + ' ' +
+                   format_value(histogram->sum()) + '\n';
+            out += name + "_count" + format_labels(labels) + ' ' +
+                   std::to_string(count) + '\n';
+        }
+    }
+    return out;
+}
+
+std::function<void(const std::string& method, double seconds, bool ok)>
+make_mcp_request_observer(std::shared_ptr<MetricsRegistry> registry)
+{
+    struct Series
+    {
+        Histogram* duration;
+        Counter* errors;
+    };
+    auto lookup = [registry](const std::string& method) {
+        const MetricLabels labels = { { "method", method } };
+        return Series{
+            &registry->histogram(
+              "agent_cpp_mcp_request_duration_seconds",
+              "MCP request round-trip time by JSON-RPC method",
+              MetricsRegistry::default_seconds_buckets(),
+              labels),
+            &registry->counter("agent_cpp_mcp_request_errors_total",
+                               "MCP requests that failed or returned an error",
+                               labels),
+        };
+    };
+
+    // The methods MCPClient sends; others are looked up per request
+    std::map<std::string, Series> known;
+    for (const char* method : { "initialize", "tools/list", "tools/call" }) {
+        known.emplace(method, lookup(method));
+    }
+
+    return [lookup, known = std::move(known)](
+             const std::string& method, double seconds, bool ok) {
+        auto it = known.find(method);
+        const Series series = it != known.end() ? it->second : lookup(method);
+        series.duration->observe(seconds);
+        if (!ok) {
+            series.errors->inc();
+        }
+    };
+}
+
+std::function<void(bool success)>
+make_oauth_refresh_observer(std::shared_ptr<MetricsRegistry> registry)
+{
+    return [registry = std::move(registry)](bool success) {
+        registry
+          ->counter("agent_cpp_oauth_token_refreshes_total",
+                    "OAuth access token refreshes by result",
+                    { { "result", success ? "success" : "failure" } })
+          .inc();
+    };
+}
+
+} // namespace agent_cpp
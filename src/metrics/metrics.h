@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace agent_cpp {
+
+// Label name/value pairs of one series, e.g. {{"tool", "search"}}
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+/// @brief Monotonic counter; increments are lock-free
+class Counter
+{
+  public:
+    void inc(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+
+    [[nodiscard]] uint64_t value() const
+    {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<uint64_t> value_{ 0 };
+};
+
+/// @brief Histogram over fixed bucket bounds; observations are lock-free
+class Histogram
+{
+  public:
+    /// @param bounds Upper bounds of the buckets, ascending. A +Inf bucket
+    /// is always added.
+    explicit Histogram(std::vector<double> bounds);
+
+    void observe(double value);
+
+    [[nodiscard]] const std::vector<double>& bounds() const { return bounds_; }
+
+    /// @brief Observations in bucket i (not cumulative); the last one is +Inf
+    [[nodiscard]] uint64_t bucket_count(size_t i) const
+    {
+        return counts_[i].load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint64_t count() const
+    {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] double sum() const
+    {
+        return sum_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::vector<double> bounds_;
+    std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+    std::atomic<uint64_t> count_{ 0 };
+    std::atomic<double> sum_{ 0 };
+};
+
+/// @brief Process-wide set of counters and histograms, rendered in the
+/// Prometheus text exposition format.
+///
+/// counter() and histogram() return a reference that stays valid for the
+/// registry's lifetime, creating the series on first use under a lock.
+/// Callers keep the reference, so recording a value afterwards only touches
+/// atomics, and render() never blocks a recording thread.
+class MetricsRegistry
+{
+  public:
+    /// @brief Buckets for latencies in seconds, 5 ms to 60 s
+    static const std::vector<double>& default_seconds_buckets();
+
+    /// @brief Get or create a counter series
+    /// @throws agent_cpp::Error if name is already registered as a histogram
+    Counter& counter(const std::string& name,
+                     const std::string& help,
+                     const MetricLabels& labels = {});
+
+    /// @brief Get or create a histogram series
+    /// @param buckets Used when the metric is first registered
+    /// @throws agent_cpp::Error if name is already registered as a counter
+    Histogram& histogram(const std::string& name,
+                         const std::string& help,
+                         const std::vector<double>& buckets,
+                         const MetricLabels& labels = {});
+
+    /// @brief Every series in the Prometheus text format (version 0.0.4)
+    [[nodiscard]] std::string render() const;
+
+  private:
+    struct Family
+    {
+        std::string help;
+        bool is_histogram = false;
+        std::vector<double> buckets;
+        std::map<MetricLabels, std::unique_ptr<Counter>> counters;
+        std::map<MetricLabels, std::unique_ptr<Histogram>> histograms;
+    };
+
+    Family& family(const std::string& name,
+                   const std::string& help,
+                   bool is_histogram,
+                   const std::vector<double>& buckets);
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Family> families_;
+};
+
+/// @brief Observer for MCPClientConfig::on_request that records MCP request
+/// latency and failures by JSON-RPC method
+std::function<void(const std::string& method, double seconds, bool ok)>
+make_mcp_request_observer(std::shared_ptr<MetricsRegistry> registry);
+
+/// @brief Observer for OAuthConfig::on_token_refresh that counts refreshes
+/// by outcome
+std::function<void(bool success)>
+make_oauth_refresh_observer(std::shared_ptr<MetricsRegistry> registry);
+
+} // namespace agent_cpp
@@ -0,0 +1,111 @@
+#include "metrics_callback.h"
+
+namespace agent_cpp {
+
+namespace {
+
+const std::vector<double>&
+ratio_buckets()
+{
+    static const std::vector<double> buckets = { 0,   0.1, 0.2, 0.3, 0.4, 0.5,
+                                                 0.6, 0.7, 0.8, 0.9, 1 };
+    return buckets;
+}
+
+} // namespace
+
+MetricsCallback::MetricsCallback(std::shared_ptr<MetricsRegistry> registry)
+  : registry_(std::move(registry))
+  , llm_calls_(registry_->counter("agent_cpp_llm_calls_total",
+                                  "Model calls that reported stats"))
+  , prompt_tokens_(registry_->counter("agent_cpp_llm_prompt_tokens_total",
+                                      "Prompt tokens sent to the model"))
+  , cached_tokens_(
+      registry_->counter("agent_cpp_llm_cached_prompt_tokens_total",
+                         "Prompt tokens reused from the KV cache"))
+  , generated_tokens_(
+      registry_->counter("agent_cpp_llm_generated_tokens_total",
+                         "Tokens generated by the model"))
+  , context_shifts_(registry_->counter(
+      "agent_cpp_llm_context_shifts_total",
+      "Times a context overflowed and old tokens were discarded"))
+  , cache_reuse_ratio_(registry_->histogram(
+      "agent_cpp_llm_kv_cache_reuse_ratio",
+      "Fraction of each prompt that was reused from the KV cache",
+      ratio_buckets()))
+  , prefill_seconds_(registry_->histogram(
+      "agent_cpp_llm_prefill_seconds",
+      "Time to get each prompt into the KV cache",
+      MetricsRegistry::default_seconds_buckets()))
+  , decode_seconds_(
+      registry_->histogram("agent_cpp_llm_decode_seconds",
+                           "Time from the end of prefill to the last token",
+                           MetricsRegistry::default_seconds_buckets()))
+  , ttft_seconds_(registry_->histogram(
+      "agent_cpp_llm_time_to_first_token_seconds",
+      "Time from the start of a model call to its first token",
+      MetricsRegistry::default_seconds_buckets()))
+{
+}
+
+void
+MetricsCallback::on_llm_stats(const GenerationStats& stats)
+{
+    llm_calls_.inc();
+    prompt_tokens_.inc(stats.n_prompt_tokens);
+    cached_tokens_.inc(stats.n_cached_tokens);
+    generated_tokens_.inc(stats.n_generated_tokens);
+    context_shifts_.inc(stats.n_context_shifts);
+    if (stats.n_prompt_tokens > 0) {
+        cache_reuse_ratio_.observe(static_cast<double>(stats.n_cached_tokens) /
+                                   stats.n_prompt_tokens);
+    }
+    prefill_seconds_.observe(stats.prefill_ms / 1000.0);
+    decode_seconds_.observe(stats.decode_ms / 1000.0);
+    // Without a generated token there is no first-token time
+    if (stats.n_generated_tokens > 0) {
+        ttft_seconds_.observe(stats.ttft_ms / 1000.0);
+    }
+}
+
+void
+MetricsCallback::on_tool_stats(const std::string& tool_name, double duration_ms)
+{
+    tool_metrics(tool_name).duration->observe(duration_ms / 1000.0);
+}
+
+void
+MetricsCallback::after_tool_execution(std::string& tool_name,
+                                      ToolResult& result)
+{
+    ToolMetrics& metrics = tool_metrics(tool_name);
+    metrics.calls->inc();
+    if (result.has_error()) {
+        metrics.errors->inc();
+    }
+}
+
+MetricsCallback::ToolMetrics&
+MetricsCallback::tool_metrics(const std::string& tool_name)
+{
+    auto it = tools_.find(tool_name);
+    if (it != tools_.end()) {
+        return it->second;
+    }
+
+    const MetricLabels labels = { { "tool", tool_name } };
+    ToolMetrics metrics{
+        &registry_->counter(
+          "agent_cpp_tool_calls_total", "Tool calls by tool name", labels),
+        &registry_->counter("agent_cpp_tool_errors_total",
+                            "Tool calls that returned an error",
+                            labels),
+        &registry_->histogram("agent_cpp_tool_duration_seconds",
+                              "Tool call latency by tool name",
+                              MetricsRegistry::default_seconds_buckets(),
+                              labels),
+    };
+    return tools_.emplace(tool_name, metrics).first->second;
+}
+
+} // namespace agent_cpp
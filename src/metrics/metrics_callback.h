@@ -0,0 +1,62 @@
+#pragma once
+
+#include "callbacks.h"
+#include "metrics.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace agent_cpp {
+
+/// @brief Callback that records LLM and tool call metrics in a registry
+///
+/// Register it before callbacks that recover from tool errors, so that it
+/// sees the original result. Tool latency comes from on_tool_stats, which
+/// times the execution alone. One instance may be shared by agents that run
+/// one at a time; give concurrent agents their own instance over the same
+/// registry.
+class MetricsCallback : public Callback
+{
+  public:
+    explicit MetricsCallback(std::shared_ptr<MetricsRegistry> registry);
+
+    void on_llm_stats(const GenerationStats& stats) override;
+
+    void on_tool_stats(const std::string& tool_name,
+                       double duration_ms) override;
+
+    void after_tool_execution(std::string& tool_name,
+                              ToolResult& result) override;
+
+    [[nodiscard]] const std::shared_ptr<MetricsRegistry>& registry() const
+    {
+        return registry_;
+    }
+
+  private:
+    struct ToolMetrics
+    {
+        Counter* calls;
+        Counter* errors;
+        Histogram* duration;
+    };
+
+    ToolMetrics& tool_metrics(const std::string& tool_name);
+
+    std::shared_ptr<MetricsRegistry> registry_;
+
+    Counter& llm_calls_;
+    Counter& prompt_tokens_;
+    Counter& cached_tokens_;
+    Counter& generated_tokens_;
+    Counter& context_shifts_;
+    Histogram& cache_reuse_ratio_;
+    Histogram& prefill_seconds_;
+    Histogram& decode_seconds_;
+    Histogram& ttft_seconds_;
+
+    std::unordered_map<std::string, ToolMetrics> tools_;
+};
+
+} // namespace agent_cpp
@@ -1,11 +1,295 @@
 #include "model.h"
 #include "chat.h"
+#include "common.h"
 #include "error.h"
+#include "stream_buffer.h"
+#include "tool_call_stream.h"
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 
 namespace agent_cpp {
 
+namespace {
+
+// Parking a state costs a copy of the sequence's KV cache, so it is only done
+// when the divergence would throw away more than a turn's worth of tokens
+constexpr size_t PROMPT_CACHE_MIN_DISCARD = 64;
+
+// Same tolerance as llama.cpp's speculative example: the draft vocabulary may
+// differ in size slightly, and the first few (special) tokens are not compared
+constexpr int DRAFT_VOCAB_MAX_SIZE_DIFFERENCE = 128;
+constexpr int DRAFT_VOCAB_CHECK_START_TOKEN = 5;
+
+// Distinct tool sets kept compiled before the grammar cache starts over
+constexpr size_t GRAMMAR_CACHE_MAX_ENTRIES = 16;
+
+// Distinct sampling settings kept built before the sampler cache starts over
+constexpr size_t SAMPLER_CACHE_MAX_ENTRIES = 16;
+
+// Bytes hashed from each end of a model file for its fingerprint
+constexpr size_t FINGERPRINT_SPAN_BYTES = 1 << 20;
+
+// Hash the size and both ends of a file: the start holds the GGUF metadata
+// and the end the last tensors, which differ between fine-tunes
+uint64_t
+fingerprint_file(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        return 0;
+    }
+    const auto size = static_cast<uint64_t>(in.tellg());
+    uint64_t hash = fnv1a_64_bytes(&size, sizeof(size));
+
+    std::vector<char> buf(std::min<uint64_t>(size, FINGERPRINT_SPAN_BYTES));
+    in.seekg(0);
+    in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+    hash = fnv1a_64_bytes(buf.data(), buf.size(), hash);
+    in.seekg(static_cast<std::streamoff>(size - buf.size()));
+    in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+    return fnv1a_64_bytes(buf.data(), buf.size(), hash);
+}
+
+// KV cache sizes are planned in steps of llama.cpp's context padding
+constexpr int N_CTX_PLAN_STEP = 256;
+
+// Integer GGUF metadata value, or fallback if the key is missing
+int64_t
+meta_int(const llama_model* model, const std::string& key, int64_t fallback)
+{
+    char buf[32];
+    if (llama_model_meta_val_str(model, key.c_str(), buf, sizeof(buf)) <= 0) {
+        return fallback;
+    }
+    char* end = nullptr;
+    const long long value = std::strtoll(buf, &end, 10);
+    return end != buf && *end == '\0' ? value : fallback;
+}
+
+// Milliseconds from start until now
+double
+elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Find the most recent earlier occurrence of the last ngram tokens of
+// history + id_last and return up to n_max tokens that followed it
+std::vector<llama_token>
+lookup_draft(const std::vector<llama_token>& history,
+             llama_token id_last,
+             size_t ngram,
+             size_t n_max)
+{
+    std::vector<llama_token> draft;
+    const size_t n = history.size() + 1;
+    if (ngram == 0 || n_max == 0 || n <= ngram) {
+        return draft;
+    }
+
+    auto at = [&](size_t i) { return i < history.size() ? history[i] : id_last; };
+    const size_t key = n - ngram;
+    for (size_t j = key; j-- > 0;) {
+        size_t k = 0;
+        while (k < ngram && at(j + k) == at(key + k)) {
+            k++;
+        }
+        if (k < ngram) {
+            continue;
+        }
+
+        for (size_t i = j + ngram; i < n && draft.size() < n_max; i++) {
+            draft.push_back(at(i));
+        }
+        break;
+    }
+    return draft;
+}
+
+// Everything the compiled grammar depends on, used as its cache key
+std::string
+grammar_cache_key(const common_chat_params& params)
+{
+    std::string key = params.grammar;
+    key += params.grammar_lazy ? "\nlazy" : "\nstrict";
+    for (const auto& trigger : params.grammar_triggers) {
+        key += "\n" + std::to_string(trigger.type) + ":" +
+               std::to_string(trigger.token) + ":" + trigger.value;
+    }
+    return key;
+}
+
+// Everything a sampler chain depends on, used as its cache key
+std::string
+sampler_cache_key(const SamplingParams& params)
+{
+    std::string key;
+    auto append = [&key](const auto& value) {
+        key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    append(params.min_p);
+    append(params.top_p);
+    append(params.top_k);
+    append(params.temp);
+    append(params.seed);
+    append(params.typical_p);
+    append(params.penalty_last_n);
+    append(params.penalty_repeat);
+    append(params.penalty_freq);
+    append(params.penalty_present);
+    append(params.mirostat);
+    append(params.mirostat_tau);
+    append(params.mirostat_eta);
+    for (const auto& bias : params.logit_bias) {
+        append(bias.token);
+        append(bias.bias);
+    }
+    return key;
+}
+
+// Compile a grammar sampler the way common_sampler_init does, turning the
+// chat template's triggers into the patterns the lazy grammar waits for
+llama_sampler*
+compile_grammar(const llama_vocab* vocab, const common_chat_params& params)
+{
+    if (!params.grammar_lazy) {
+        return llama_sampler_init_grammar(vocab, params.grammar.c_str(), "root");
+    }
+
+    std::vector<std::string> patterns_at_start;
+    std::vector<std::string> patterns_anywhere;
+    std::vector<llama_token> trigger_tokens;
+    for (const auto& trigger : params.grammar_triggers) {
+        switch (trigger.type) {
+            case COMMON_GRAMMAR_TRIGGER_TYPE_WORD:
+                patterns_anywhere.push_back(regex_escape(trigger.value));
+                break;
+            case COMMON_GRAMMAR_TRIGGER_TYPE_PATTERN:
+                patterns_anywhere.push_back(trigger.value);
+                break;
+            case COMMON_GRAMMAR_TRIGGER_TYPE_PATTERN_FULL: {
+                const std::string& pattern = trigger.value;
+                std::string anchored = "^$";
+                if (!pattern.empty()) {
+                    anchored = (pattern.front() != '^' ? "^" : "") + pattern +
+                               (pattern.back() != '$' ? "$" : "");
+                }
+                patterns_at_start.push_back(anchored);
+                break;
+            }
+            case COMMON_GRAMMAR_TRIGGER_TYPE_TOKEN:
+                trigger_tokens.push_back(trigger.token);
+                break;
+        }
+    }
+
+    std::vector<std::string> trigger_patterns;
+    if (!patterns_at_start.empty()) {
+        trigger_patterns.push_back(
+          "^(" + string_join(patterns_at_start, "|") + ")[\\s\\S]*");
+    }
+    if (!patterns_anywhere.empty()) {
+        trigger_patterns.push_back(
+          "^[\\s\\S]*?(" + string_join(patterns_anywhere, "|") + ")[\\s\\S]*");
+    }
+
+    std::vector<const char*> trigger_patterns_c;
+    trigger_patterns_c.reserve(trigger_patterns.size());
+    for (const auto& pattern : trigger_patterns) {
+        trigger_patterns_c.push_back(pattern.c_str());
+    }
+
+    return llama_sampler_init_grammar_lazy_patterns(vocab,
+                                                    params.grammar.c_str(),
+                                                    "root",
+                                                    trigger_patterns_c.data(),
+                                                    trigger_patterns_c.size(),
+                                                    trigger_tokens.data(),
+                                                    trigger_tokens.size());
+}
+
+// Clears the per-call state of generate() when it returns or throws
+struct GenerateScope
+{
+    llama_sampler*& grammar;
+    std::shared_ptr<CancellationToken>& cancellation;
+    ~GenerateScope()
+    {
+        if (grammar != nullptr) {
+            llama_sampler_free(grammar);
+            grammar = nullptr;
+        }
+        cancellation.reset();
+    }
+};
+
+} // anonymous namespace
+
+llama_sampler*
+make_sampler_chain(const SamplingParams& params, const llama_vocab* vocab)
+{
+    llama_sampler* sampler =
+      llama_sampler_chain_init(llama_sampler_chain_default_params());
+    if (!params.logit_bias.empty()) {
+        llama_sampler_chain_add(
+          sampler,
+          llama_sampler_init_logit_bias(
+            llama_vocab_n_tokens(vocab),
+            static_cast<int32_t>(params.logit_bias.size()),
+            params.logit_bias.data()));
+    }
+    // Neutral penalties are left out rather than scanning the history
+    if (params.penalty_last_n != 0 &&
+        (params.penalty_repeat != 1.0F || params.penalty_freq != 0.0F ||
+         params.penalty_present != 0.0F)) {
+        llama_sampler_chain_add(
+          sampler,
+          llama_sampler_init_penalties(params.penalty_last_n,
+                                       params.penalty_repeat,
+                                       params.penalty_freq,
+                                       params.penalty_present));
+    }
+
+    if (params.mirostat == 1 || params.mirostat == 2) {
+        llama_sampler_chain_add(sampler, llama_sampler_init_temp(params.temp));
+        if (params.mirostat == 1) {
+            llama_sampler_chain_add(
+              sampler,
+              llama_sampler_init_mirostat(llama_vocab_n_tokens(vocab),
+                                          params.seed,
+                                          params.mirostat_tau,
+                                          params.mirostat_eta,
+                                          100));
+        } else {
+            llama_sampler_chain_add(
+              sampler,
+              llama_sampler_init_mirostat_v2(
+                params.seed, params.mirostat_tau, params.mirostat_eta));
+        }
+        return sampler;
+    }
+
+    llama_sampler_chain_add(sampler, llama_sampler_init_top_k(params.top_k));
+    if (params.typical_p < 1.0F) {
+        llama_sampler_chain_add(
+          sampler, llama_sampler_init_typical(params.typical_p, 1));
+    }
+    llama_sampler_chain_add(sampler,
+                            llama_sampler_init_top_p(params.top_p, 1));
+    llama_sampler_chain_add(sampler,
+                            llama_sampler_init_min_p(params.min_p, 1));
+    llama_sampler_chain_add(sampler, llama_sampler_init_temp(params.temp));
+    llama_sampler_chain_add(sampler, llama_sampler_init_dist(params.seed));
+    return sampler;
+}
+
 std::shared_ptr<ModelWeights>
 ModelWeights::create(const std::string& model_path)
 {
@@ -28,9 +312,130 @@ ModelWeights::create(const std::string& model_path)
     weights->templates_ =
       std::shared_ptr<common_chat_templates>(std::move(tmpls));
 
+    weights->initialize_pieces();
+
+    // Head sizes differ from n_embd / n_head in some architectures
+    char arch[64] = {};
+    llama_model_meta_val_str(
+      weights->model_, "general.architecture", arch, sizeof(arch));
+    const llama_model* model = weights->model_;
+    const int64_t n_head = std::max(1, llama_model_n_head(model));
+    const int64_t n_embd_head = llama_model_n_embd(model) / n_head;
+    const int64_t n_head_kv = llama_model_n_head_kv(model);
+    const std::string prefix = std::string(arch) + ".attention.";
+    weights->n_embd_k_gqa_ =
+      meta_int(model, prefix + "key_length", n_embd_head) * n_head_kv;
+    weights->n_embd_v_gqa_ =
+      meta_int(model, prefix + "value_length", n_embd_head) * n_head_kv;
+
+    weights->fingerprint_ = fingerprint_file(model_path);
+    const common_chat_templates* templates = weights->templates_.get();
+    weights->template_fingerprint_ =
+      fnv1a_64(common_chat_templates_source(templates, "tool_use"),
+               fnv1a_64(common_chat_templates_source(templates)));
+
     return weights;
 }
 
+CacheFileKey
+ModelWeights::cache_key(const ModelConfig& config, uint64_t tools_hash) const
+{
+    CacheFileKey key;
+    key.model_hash = fingerprint_;
+    key.template_hash = template_fingerprint_;
+    key.tools_hash = tools_hash;
+    key.type_k = config.cache_type_k;
+    key.type_v = config.cache_type_v;
+    return key;
+}
+
+size_t
+ModelWeights::kv_cache_bytes(int n_ctx,
+                             ggml_type type_k,
+                             ggml_type type_v) const
+{
+    if (llama_model_is_recurrent(model_)) {
+        return 0;
+    }
+    const size_t bytes_per_token = ggml_row_size(type_k, n_embd_k_gqa_) +
+                                   ggml_row_size(type_v, n_embd_v_gqa_);
+    return bytes_per_token * llama_model_n_layer(model_) * n_ctx;
+}
+
+ContextPlan
+ModelWeights::plan_contexts(const MemoryBudget& budget) const
+{
+    const int max_n_ctx =
+      budget.max_n_ctx > 0 ? budget.max_n_ctx : llama_model_n_ctx_train(model_);
+    const int min_n_ctx = std::min(budget.min_n_ctx, max_n_ctx);
+    const size_t n_contexts = std::max(1, budget.n_contexts);
+
+    // Without flash attention V stays f16 whatever K is
+    auto type_v_for = [&](ggml_type type_k) {
+        return budget.flash_attn ? type_k : GGML_TYPE_F16;
+    };
+
+    auto plan_for = [&](ggml_type type, int n_ctx) {
+        ContextPlan plan;
+        plan.n_ctx = n_ctx;
+        plan.cache_type_k = type;
+        plan.cache_type_v = type_v_for(type);
+        plan.kv_bytes_per_context =
+          kv_cache_bytes(n_ctx, plan.cache_type_k, plan.cache_type_v);
+        plan.bytes_per_context =
+          plan.kv_bytes_per_context + budget.overhead_bytes_per_context;
+        plan.max_contexts =
+          plan.bytes_per_context > 0
+            ? static_cast<int>(std::min<size_t>(
+                budget.bytes / plan.bytes_per_context, INT32_MAX))
+            : INT32_MAX;
+        plan.fits = static_cast<size_t>(plan.max_contexts) >= n_contexts;
+        return plan;
+    };
+
+    // Largest n_ctx (in padding steps) whose contexts all fit, or 0
+    auto largest_n_ctx = [&](ggml_type type) {
+        const size_t per_context = budget.bytes / n_contexts;
+        if (per_context <= budget.overhead_bytes_per_context) {
+            return 0;
+        }
+        const size_t kv_bytes = per_context - budget.overhead_bytes_per_context;
+        const size_t step_bytes =
+          kv_cache_bytes(N_CTX_PLAN_STEP, type, type_v_for(type));
+        const size_t n_steps =
+          step_bytes > 0 ? kv_bytes / step_bytes : SIZE_MAX;
+        const size_t n_ctx =
+          std::min<size_t>(n_steps, INT32_MAX / N_CTX_PLAN_STEP) *
+          N_CTX_PLAN_STEP;
+        return static_cast<int>(std::min<size_t>(n_ctx, max_n_ctx));
+    };
+
+    if (largest_n_ctx(GGML_TYPE_F16) >= max_n_ctx) {
+        return plan_for(GGML_TYPE_F16, max_n_ctx);
+    }
+    for (ggml_type type : { GGML_TYPE_Q8_0, GGML_TYPE_Q4_0 }) {
+        const int n_ctx = largest_n_ctx(type);
+        if (n_ctx >= min_n_ctx) {
+            return plan_for(type, n_ctx);
+        }
+    }
+    // Too many contexts: report how many of the smallest ones would fit
+    return plan_for(GGML_TYPE_Q4_0, min_n_ctx);
+}
+
+void
+ModelWeights::initialize_pieces()
+{
+    const llama_vocab* vocab = get_vocab();
+    const int n_vocab = llama_vocab_n_tokens(vocab);
+    piece_offsets_.reserve(n_vocab + 1);
+    for (llama_token token = 0; token < n_vocab; token++) {
+        piece_offsets_.push_back(piece_data_.size());
+        piece_data_ += common_token_to_piece(vocab, token, true);
+    }
+    piece_offsets_.push_back(piece_data_.size());
+}
+
 ModelWeights::~ModelWeights()
 {
     if (model_ != nullptr) {
@@ -57,8 +462,26 @@ Model::create_with_weights(std::shared_ptr<ModelWeights> weights,
 
 Model::~Model()
 {
-    if (sampler_ != nullptr) {
-        llama_sampler_free(sampler_);
+    for (auto& [key, grammar] : grammar_cache_) {
+        llama_sampler_free(grammar);
+    }
+    if (grammar_ != nullptr) {
+        llama_sampler_free(grammar_);
+    }
+    if (draft_sampler_ != nullptr) {
+        llama_sampler_free(draft_sampler_);
+    }
+    if (draft_ctx_ != nullptr) {
+        llama_free(draft_ctx_);
+    }
+    if (spec_batch_.token != nullptr) {
+        llama_batch_free(spec_batch_);
+    }
+    if (prefill_batch_.token != nullptr) {
+        llama_batch_free(prefill_batch_);
+    }
+    for (auto& [key, sampler] : sampler_cache_) {
+        llama_sampler_free(sampler);
     }
     if (ctx_ != nullptr) {
         llama_free(ctx_);
@@ -73,18 +496,60 @@ Model::Model(Model&& other) noexcept
   , processed_tokens_(std::move(other.processed_tokens_))
   , n_past_(other.n_past_)
   , config_(other.config_)
+  , prompt_cache_(std::move(other.prompt_cache_))
+  , prompt_tokenizer_(std::move(other.prompt_tokenizer_))
+  , draft_ctx_(other.draft_ctx_)
+  , draft_sampler_(other.draft_sampler_)
+  , draft_processed_(std::move(other.draft_processed_))
+  , spec_batch_(other.spec_batch_)
+  , prefill_batch_(other.prefill_batch_)
+  , grammar_(other.grammar_)
+  , grammar_cache_(std::move(other.grammar_cache_))
+  , sampler_cache_(std::move(other.sampler_cache_))
+  , candidates_(std::move(other.candidates_))
+  , n_keep_(other.n_keep_)
+  , discarded_tokens_(std::move(other.discarded_tokens_))
+  , stats_(other.stats_)
+  , generate_start_(other.generate_start_)
+  , checkpoint_writer_(std::move(other.checkpoint_writer_))
+  , last_checkpoint_(other.last_checkpoint_)
 {
     other.ctx_ = nullptr;
     other.sampler_ = nullptr;
     other.n_past_ = 0;
+    other.draft_ctx_ = nullptr;
+    other.draft_sampler_ = nullptr;
+    other.spec_batch_ = llama_batch{};
+    other.prefill_batch_ = llama_batch{};
+    other.grammar_ = nullptr;
+    other.grammar_cache_.clear();
+    other.sampler_cache_.clear();
 }
 
 Model&
 Model::operator=(Model&& other) noexcept
 {
     if (this != &other) {
-        if (sampler_ != nullptr) {
-            llama_sampler_free(sampler_);
+        for (auto& [key, grammar] : grammar_cache_) {
+            llama_sampler_free(grammar);
+        }
+        if (grammar_ != nullptr) {
+            llama_sampler_free(grammar_);
+        }
+        if (draft_sampler_ != nullptr) {
+            llama_sampler_free(draft_sampler_);
+        }
+        if (draft_ctx_ != nullptr) {
+            llama_free(draft_ctx_);
+        }
+        if (spec_batch_.token != nullptr) {
+            llama_batch_free(spec_batch_);
+        }
+        if (prefill_batch_.token != nullptr) {
+            llama_batch_free(prefill_batch_);
+        }
+        for (auto& [key, sampler] : sampler_cache_) {
+            llama_sampler_free(sampler);
         }
         if (ctx_ != nullptr) {
             llama_free(ctx_);
@@ -96,10 +561,34 @@ Model::operator=(Model&& other) noexcept
         processed_tokens_ = std::move(other.processed_tokens_);
         n_past_ = other.n_past_;
         config_ = other.config_;
+        prompt_cache_ = std::move(other.prompt_cache_);
+        prompt_tokenizer_ = std::move(other.prompt_tokenizer_);
+        draft_ctx_ = other.draft_ctx_;
+        draft_sampler_ = other.draft_sampler_;
+        draft_processed_ = std::move(other.draft_processed_);
+        spec_batch_ = other.spec_batch_;
+        prefill_batch_ = other.prefill_batch_;
+        grammar_ = other.grammar_;
+        grammar_cache_ = std::move(other.grammar_cache_);
+        sampler_cache_ = std::move(other.sampler_cache_);
+        candidates_ = std::move(other.candidates_);
+        n_keep_ = other.n_keep_;
+        discarded_tokens_ = std::move(other.discarded_tokens_);
+        stats_ = other.stats_;
+        generate_start_ = other.generate_start_;
+        checkpoint_writer_ = std::move(other.checkpoint_writer_);
+        last_checkpoint_ = other.last_checkpoint_;
 
         other.ctx_ = nullptr;
         other.sampler_ = nullptr;
         other.n_past_ = 0;
+        other.draft_ctx_ = nullptr;
+        other.draft_sampler_ = nullptr;
+        other.spec_batch_ = llama_batch{};
+        other.prefill_batch_ = llama_batch{};
+        other.grammar_ = nullptr;
+        other.grammar_cache_.clear();
+        other.sampler_cache_.clear();
     }
     return *this;
 }
@@ -116,23 +605,84 @@ Model::initialize_context(const ModelConfig& model_config)
     ctx_params.n_threads_batch = model_config.n_threads_batch;
     ctx_params.type_k = model_config.cache_type_k;
     ctx_params.type_v = model_config.cache_type_v;
+    ctx_params.flash_attn_type = model_config.flash_attn;
 
     ctx_ = llama_init_from_model(weights_->get_model(), ctx_params);
     if (ctx_ == nullptr) {
         throw ModelError("failed to create llama context");
     }
 
-    sampler_ = llama_sampler_chain_init(llama_sampler_chain_default_params());
-    llama_sampler_chain_add(sampler_,
-                            llama_sampler_init_top_k(model_config.top_k));
-    llama_sampler_chain_add(sampler_,
-                            llama_sampler_init_top_p(model_config.top_p, 1));
-    llama_sampler_chain_add(sampler_,
-                            llama_sampler_init_min_p(model_config.min_p, 1));
-    llama_sampler_chain_add(sampler_,
-                            llama_sampler_init_temp(model_config.temp));
-    llama_sampler_chain_add(sampler_,
-                            llama_sampler_init_dist(model_config.seed));
+    sampler_ = get_sampler(model_config);
+
+    // Allocated once so prompt ingestion does not allocate per chunk
+    prefill_batch_ = llama_batch_init(llama_n_batch(ctx_), 0, 1);
+    processed_tokens_.reserve(llama_n_ctx(ctx_));
+
+    if (model_config.prompt_cache_bytes > 0) {
+        prompt_cache_ =
+          std::make_unique<PromptCache>(model_config.prompt_cache_bytes);
+    }
+
+    if (model_config.n_draft > 0) {
+        if (model_config.draft_weights) {
+            initialize_draft(model_config);
+        }
+        if (model_config.draft_weights || model_config.lookup_ngram_size > 0) {
+            // Room for the last sampled token plus the drafts, all with logits
+            spec_batch_ = llama_batch_init(model_config.n_draft + 1, 0, 1);
+        }
+    }
+
+    if (!model_config.checkpoint_path.empty()) {
+        // Resume from the last checkpoint; a stale one is just overwritten
+        load_cache(model_config.checkpoint_path);
+        checkpoint_writer_ = std::make_unique<CheckpointWriter>(
+          model_config.checkpoint_path, weights_->cache_key(config_, 0));
+        last_checkpoint_ = std::chrono::steady_clock::now();
+    }
+}
+
+void
+Model::initialize_draft(const ModelConfig& model_config)
+{
+    const llama_vocab* vocab = weights_->get_vocab();
+    const llama_vocab* draft_vocab = model_config.draft_weights->get_vocab();
+
+    // Drafted token ids are fed to the main model as-is, so both models must
+    // agree on them. Allow a few extra (unused) tokens at the end, as
+    // fine-tunes of the same base model often pad the vocabulary.
+    const int n_vocab = llama_vocab_n_tokens(vocab);
+    const int n_draft_vocab = llama_vocab_n_tokens(draft_vocab);
+    if (std::abs(n_vocab - n_draft_vocab) > DRAFT_VOCAB_MAX_SIZE_DIFFERENCE ||
+        llama_vocab_bos(vocab) != llama_vocab_bos(draft_vocab) ||
+        llama_vocab_eos(vocab) != llama_vocab_eos(draft_vocab)) {
+        throw ModelError("draft model vocabulary does not match the model");
+    }
+    for (int i = DRAFT_VOCAB_CHECK_START_TOKEN;
+         i < std::min(n_vocab, n_draft_vocab);
+         i++) {
+        if (std::strcmp(llama_vocab_get_text(vocab, i),
+                        llama_vocab_get_text(draft_vocab, i)) != 0) {
+            throw ModelError("draft model vocabulary does not match the model");
+        }
+    }
+
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = model_config.n_ctx;
+    ctx_params.n_batch = model_config.n_batch;
+    ctx_params.n_threads = model_config.n_threads;
+    ctx_params.n_threads_batch = model_config.n_threads_batch;
+    ctx_params.type_k = model_config.cache_type_k;
+    ctx_params.type_v = model_config.cache_type_v;
+    ctx_params.flash_attn_type = model_config.flash_attn;
+
+    draft_ctx_ =
+      llama_init_from_model(model_config.draft_weights->get_model(), ctx_params);
+    if (draft_ctx_ == nullptr) {
+        throw ModelError("failed to create draft llama context");
+    }
+
+    draft_sampler_ = llama_sampler_init_greedy();
 }
 
 std::vector<llama_token>
@@ -163,8 +713,11 @@ Model::tokenize(const std::string& prompt) const
 common_chat_msg
 Model::generate(const std::vector<common_chat_msg>& messages,
                 const std::vector<common_chat_tool>& tools,
-                const ResponseCallback& callback)
+                const ResponseCallback& callback,
+                const GenerateOptions& options)
 {
+    const auto start = std::chrono::steady_clock::now();
+
     common_chat_templates_inputs inputs;
     inputs.messages = messages;
     inputs.tools = tools;
@@ -175,19 +728,51 @@ Model::generate(const std::vector<common_chat_msg>& messages,
     auto params =
       common_chat_templates_apply(weights_->get_templates(), inputs);
 
-    // Tokenize the prompt
-    std::vector<llama_token> prompt_tokens = tokenize(params.prompt);
+    // Tokenize the prompt, re-tokenizing only what changed since the last turn
+    // (same BOS handling as tokenize())
+    const std::vector<llama_token>& prompt_tokens = prompt_tokenizer_.tokenize(
+      weights_->get_vocab(), params.prompt, processed_tokens_.empty());
     if (prompt_tokens.empty()) {
         throw ModelError("failed to tokenize prompt");
     }
+    const double prompt_ms = elapsed_ms(start);
 
-    std::string response = generate_from_tokens(prompt_tokens, callback);
+    GenerateScope generate_scope{ grammar_, cancellation_ };
+    cancellation_ = options.cancellation;
+    // Every call starts with fresh penalty history and mirostat state
+    sampler_ = get_sampler(options.sampling ? *options.sampling : config_);
+    llama_sampler_reset(sampler_);
+    if (config_.constrain_tool_calls && !tools.empty() &&
+        !params.grammar.empty()) {
+        grammar_ = make_grammar(params);
+    }
 
     common_chat_syntax syntax;
     // Use explicitly configured format, or fall back to auto-detected format
     syntax.format = config_.chat_format.value_or(params.format);
     syntax.parse_tool_calls = true;
 
+    std::string response;
+    if (options.on_tool_call && !tools.empty()) {
+        ToolCallStream stream(syntax, callback, options.on_tool_call);
+        response = generate_from_tokens(prompt_tokens, stream.as_callback());
+    } else {
+        response = generate_from_tokens(prompt_tokens, callback);
+    }
+
+    stats_.prompt_ms = prompt_ms;
+    if (stats_.n_generated_tokens > 0) {
+        stats_.ttft_ms += prompt_ms;
+    }
+    if (options.stats != nullptr) {
+        *options.stats = stats_;
+    }
+
+    if (checkpoint_writer_ &&
+        elapsed_ms(last_checkpoint_) >= config_.checkpoint_interval_ms) {
+        checkpoint();
+    }
+
     auto parsed_msg = common_chat_parse(response, false, syntax);
     parsed_msg.role = "assistant";
 
@@ -203,12 +788,17 @@ Model::generate_from_tokens(const std::vector<llama_token>& all_tokens,
     const int n_ctx = llama_n_ctx(ctx_);
     const int n_batch = llama_n_batch(ctx_);
 
+    stats_ = GenerationStats{};
+    generate_start_ = std::chrono::steady_clock::now();
+    stats_.n_prompt_tokens = static_cast<int>(all_tokens.size());
+
     // Find common prefix length between processed tokens and new tokens
-    size_t common_prefix = 0;
-    while (common_prefix < processed_tokens_.size() &&
-           common_prefix < all_tokens.size() &&
-           processed_tokens_[common_prefix] == all_tokens[common_prefix]) {
-        common_prefix++;
+    size_t common_prefix = match_processed_tokens(all_tokens);
+
+    // A shifted KV cache no longer matches a plain prefill of its tokens, so
+    // it is neither parked nor replaced
+    if (prompt_cache_ && discarded_tokens_.empty()) {
+        common_prefix = restore_from_prompt_cache(all_tokens, common_prefix);
     }
 
     // If tokens diverged, clear KV cache from divergence point onwards
@@ -219,52 +809,71 @@ Model::generate_from_tokens(const std::vector<llama_token>& all_tokens,
         n_past_ = common_prefix;
     }
 
-    size_t i = common_prefix;
+    // Tokens dropped by context shifts are in the prompt but not in the cache
+    size_t i = common_prefix + discarded_tokens_.size();
+    stats_.n_cached_tokens = static_cast<int>(i);
+    stats_.n_prefill_tokens = stats_.n_prompt_tokens - stats_.n_cached_tokens;
     while (i < all_tokens.size()) {
+        if (cancellation_) {
+            cancellation_->throw_if_cancelled();
+        }
+
         size_t batch_size = std::min(all_tokens.size() - i, (size_t)n_batch);
 
-        if (n_past_ + (int)batch_size > n_ctx) {
+        if (n_past_ + (int)batch_size > n_ctx &&
+            !shift_context((int)batch_size)) {
             throw ModelError("context size exceeded");
         }
 
-        std::vector<llama_token> batch_tokens(
-          all_tokens.begin() + i, all_tokens.begin() + i + batch_size);
-
-        llama_batch batch =
-          llama_batch_get_one(batch_tokens.data(), batch_tokens.size());
+        // Only the last prompt token needs logits
+        for (size_t j = 0; j < batch_size; j++) {
+            prefill_batch_.token[j] = all_tokens[i + j];
+            prefill_batch_.pos[j] = n_past_ + static_cast<llama_pos>(j);
+            prefill_batch_.n_seq_id[j] = 1;
+            prefill_batch_.seq_id[j][0] = 0;
+            prefill_batch_.logits[j] = j + 1 == batch_size;
+        }
+        prefill_batch_.n_tokens = static_cast<int32_t>(batch_size);
 
-        if (llama_decode(ctx_, batch) != 0) {
+        if (llama_decode(ctx_, prefill_batch_) != 0) {
             throw ModelError("failed to decode batch");
         }
 
-        n_past_ += batch_tokens.size();
-        processed_tokens_.insert(
-          processed_tokens_.end(), batch_tokens.begin(), batch_tokens.end());
+        n_past_ += batch_size;
+        processed_tokens_.insert(processed_tokens_.end(),
+                                 all_tokens.begin() + i,
+                                 all_tokens.begin() + i + batch_size);
         i += batch_size;
     }
 
+    stats_.prefill_ms = elapsed_ms(generate_start_);
+    const auto decode_start = std::chrono::steady_clock::now();
+
+    StreamBuffer stream(callback,
+                        config_.stream_min_bytes,
+                        std::chrono::milliseconds(config_.stream_max_delay_ms));
+    if (spec_batch_.token != nullptr) {
+        response = generate_speculative(stream);
+        stream.flush();
+        stats_.decode_ms = elapsed_ms(decode_start);
+        return response;
+    }
+
     llama_token new_token_id{};
     while (true) {
-        new_token_id = llama_sampler_sample(sampler_, ctx_, -1);
+        if (cancellation_) {
+            cancellation_->throw_if_cancelled();
+        }
+
+        new_token_id = sample_token(-1);
 
         if (llama_vocab_is_eog(vocab, new_token_id)) {
             break;
         }
 
-        char buf[256];
-        int n =
-          llama_token_to_piece(vocab, new_token_id, buf, sizeof(buf), 0, true);
-        if (n < 0) {
-            throw ModelError("failed to convert token to piece");
-        }
-        std::string piece(buf, n);
-
-        if (callback) {
-            callback(piece);
-        }
-        response += piece;
+        emit_token(new_token_id, stream, response);
 
-        if (n_past_ + 1 > n_ctx) {
+        if (n_past_ + 1 > n_ctx && !shift_context(1)) {
             throw ModelError("context size exceeded during generation");
         }
 
@@ -277,34 +886,474 @@ Model::generate_from_tokens(const std::vector<llama_token>& all_tokens,
         processed_tokens_.push_back(new_token_id);
     }
 
+    stream.flush();
+    stats_.decode_ms = elapsed_ms(decode_start);
     return response;
 }
 
+std::string
+Model::generate_speculative(StreamBuffer& stream)
+{
+    const llama_vocab* vocab = weights_->get_vocab();
+    const int n_ctx = llama_n_ctx(ctx_);
+    llama_memory_t mem = llama_get_memory(ctx_);
+    std::string response{};
+
+    // id_last is sampled but not yet decoded. Each round decodes it together
+    // with the drafts that follow it; the logits at each position tell which
+    // token the main model would have sampled there, so drafts are accepted
+    // while they agree and the first disagreement becomes the next id_last.
+    llama_token id_last = sample_token(-1);
+    while (!llama_vocab_is_eog(vocab, id_last)) {
+        if (cancellation_) {
+            cancellation_->throw_if_cancelled();
+        }
+
+        emit_token(id_last, stream, response);
+
+        if (n_past_ + 1 > n_ctx && !shift_context(1)) {
+            throw ModelError("context size exceeded during generation");
+        }
+
+        const int n_room = n_ctx - n_past_ - 1;
+        std::vector<llama_token> draft =
+          propose_draft(id_last, std::min(config_.n_draft, n_room));
+        stats_.n_draft_tokens += static_cast<int>(draft.size());
+
+        common_batch_clear(spec_batch_);
+        common_batch_add(spec_batch_, id_last, n_past_, { 0 }, true);
+        for (size_t i = 0; i < draft.size(); i++) {
+            common_batch_add(spec_batch_, draft[i], n_past_ + 1 + i, { 0 }, true);
+        }
+        if (llama_decode(ctx_, spec_batch_) != 0) {
+            throw ModelError("failed to decode token");
+        }
+
+        n_past_++;
+        processed_tokens_.push_back(id_last);
+
+        size_t n_accepted = 0;
+        llama_token next = sample_token(0);
+        while (n_accepted < draft.size() && next == draft[n_accepted] &&
+               !llama_vocab_is_eog(vocab, next)) {
+            emit_token(next, stream, response);
+            n_past_++;
+            processed_tokens_.push_back(next);
+            n_accepted++;
+            next = sample_token(static_cast<int>(n_accepted));
+        }
+        stats_.n_draft_accepted += static_cast<int>(n_accepted);
+
+        // Drop the rejected drafts (and an accepted end-of-generation token,
+        // which the plain loop never decodes either)
+        llama_memory_seq_rm(mem, 0, n_past_, -1);
+        id_last = next;
+    }
+
+    return response;
+}
+
+std::vector<llama_token>
+Model::propose_draft(llama_token id_last, int n_max)
+{
+    if (draft_ctx_ != nullptr) {
+        return draft_tokens(id_last, n_max);
+    }
+    return lookup_draft(processed_tokens_,
+                        id_last,
+                        static_cast<size_t>(config_.lookup_ngram_size),
+                        static_cast<size_t>(std::max(n_max, 0)));
+}
+
+std::vector<llama_token>
+Model::draft_tokens(llama_token id_last, int n_max)
+{
+    std::vector<llama_token> draft;
+    if (n_max <= 0) {
+        return draft;
+    }
+
+    // Bring the draft KV cache in line with processed_tokens_ + id_last
+    size_t common_prefix = 0;
+    while (common_prefix < draft_processed_.size() &&
+           common_prefix < processed_tokens_.size() &&
+           draft_processed_[common_prefix] == processed_tokens_[common_prefix]) {
+        common_prefix++;
+    }
+    if (common_prefix < draft_processed_.size()) {
+        llama_memory_seq_rm(llama_get_memory(draft_ctx_), 0, common_prefix, -1);
+        draft_processed_.resize(common_prefix);
+    }
+
+    std::vector<llama_token> pending(processed_tokens_.begin() + common_prefix,
+                                     processed_tokens_.end());
+    pending.push_back(id_last);
+
+    const size_t n_batch = llama_n_batch(draft_ctx_);
+    for (size_t i = 0; i < pending.size(); i += n_batch) {
+        const size_t batch_size = std::min(pending.size() - i, n_batch);
+        llama_batch batch =
+          llama_batch_get_one(pending.data() + i, static_cast<int>(batch_size));
+        if (llama_decode(draft_ctx_, batch) != 0) {
+            throw ModelError("failed to decode draft batch");
+        }
+        draft_processed_.insert(draft_processed_.end(),
+                                pending.begin() + i,
+                                pending.begin() + i + batch_size);
+    }
+
+    const llama_vocab* vocab = weights_->get_vocab();
+    while (true) {
+        llama_token token = llama_sampler_sample(draft_sampler_, draft_ctx_, -1);
+        draft.push_back(token);
+        if (static_cast<int>(draft.size()) >= n_max ||
+            llama_vocab_is_eog(vocab, token)) {
+            break;
+        }
+
+        llama_batch batch = llama_batch_get_one(&token, 1);
+        if (llama_decode(draft_ctx_, batch) != 0) {
+            throw ModelError("failed to decode draft token");
+        }
+        draft_processed_.push_back(token);
+    }
+
+    return draft;
+}
+
+llama_token
+Model::sample_token(int idx)
+{
+    if (grammar_ == nullptr) {
+        return llama_sampler_sample(sampler_, ctx_, idx);
+    }
+
+    const llama_vocab* vocab = weights_->get_vocab();
+    const int n_vocab = llama_vocab_n_tokens(vocab);
+    const float* logits = llama_get_logits_ith(ctx_, idx);
+    auto fill_candidates = [&]() {
+        candidates_.resize(n_vocab);
+        for (llama_token id = 0; id < n_vocab; id++) {
+            candidates_[id] = llama_token_data{ id, logits[id], 0.0F };
+        }
+        return llama_token_data_array{
+            candidates_.data(), candidates_.size(), -1, false
+        };
+    };
+
+    // Fast path: sample without the grammar and only check the chosen token,
+    // instead of matching every vocabulary entry against the grammar
+    llama_token_data_array cur_p = fill_candidates();
+    llama_sampler_apply(sampler_, &cur_p);
+    llama_token id = cur_p.data[cur_p.selected].id;
+
+    llama_token_data single = { id, 1.0F, 0.0F };
+    llama_token_data_array single_p = { &single, 1, -1, false };
+    llama_sampler_apply(grammar_, &single_p);
+
+    if (std::isinf(single.logit)) {
+        // Rejected: mask the full vocabulary with the grammar and resample
+        cur_p = fill_candidates();
+        llama_sampler_apply(grammar_, &cur_p);
+        llama_sampler_apply(sampler_, &cur_p);
+        id = cur_p.data[cur_p.selected].id;
+    }
+
+    llama_sampler_accept(grammar_, id);
+    llama_sampler_accept(sampler_, id);
+    return id;
+}
+
+llama_sampler*
+Model::make_grammar(const common_chat_params& params)
+{
+    const std::string key = grammar_cache_key(params);
+    auto it = grammar_cache_.find(key);
+    if (it == grammar_cache_.end()) {
+        llama_sampler* grammar = compile_grammar(weights_->get_vocab(), params);
+        if (grammar == nullptr) {
+            throw ModelError("failed to compile tool-call grammar");
+        }
+
+        if (grammar_cache_.size() >= GRAMMAR_CACHE_MAX_ENTRIES) {
+            for (auto& [cached_key, cached] : grammar_cache_) {
+                llama_sampler_free(cached);
+            }
+            grammar_cache_.clear();
+        }
+        it = grammar_cache_.emplace(key, grammar).first;
+    }
+
+    // The cached copy is never sampled with, so a clone starts from the
+    // initial grammar state without re-parsing
+    return llama_sampler_clone(it->second);
+}
+
+size_t
+Model::match_processed_tokens(const std::vector<llama_token>& all_tokens)
+{
+    size_t n_matched = 0;
+    auto match = [&](const llama_token* tokens, size_t n_tokens) {
+        size_t j = 0;
+        while (j < n_tokens && n_matched < all_tokens.size() &&
+               all_tokens[n_matched] == tokens[j]) {
+            j++;
+            n_matched++;
+        }
+        return j == n_tokens;
+    };
+
+    if (discarded_tokens_.empty()) {
+        match(processed_tokens_.data(), processed_tokens_.size());
+        return n_matched;
+    }
+
+    // The conversation is the kept tokens, then the dropped ones, then the
+    // rest of the KV cache
+    if (match(processed_tokens_.data(), n_keep_) &&
+        match(discarded_tokens_.data(), discarded_tokens_.size())) {
+        match(processed_tokens_.data() + n_keep_,
+              processed_tokens_.size() - n_keep_);
+        return n_matched - discarded_tokens_.size();
+    }
+
+    // Diverged before the end of the dropped range: only the kept tokens
+    // are still at the positions a plain prefill would give them
+    discarded_tokens_.clear();
+    return std::min(n_matched, n_keep_);
+}
+
+bool
+Model::shift_context(int n_tokens)
+{
+    llama_memory_t mem = llama_get_memory(ctx_);
+    if (config_.context_overflow != ContextOverflow::Shift ||
+        !llama_memory_can_shift(mem)) {
+        return false;
+    }
+
+    if (discarded_tokens_.empty()) {
+        if (config_.n_keep >= 0) {
+            n_keep_ = std::min(static_cast<size_t>(config_.n_keep),
+                               processed_tokens_.size());
+        } else {
+            // Keep the first message, which ends with an end-of-turn token
+            const llama_vocab* vocab = weights_->get_vocab();
+            n_keep_ = !processed_tokens_.empty() &&
+                          processed_tokens_[0] == llama_vocab_bos(vocab)
+                        ? 1
+                        : 0;
+            for (size_t j = 1; j < processed_tokens_.size(); j++) {
+                if (llama_vocab_is_eog(vocab, processed_tokens_[j])) {
+                    n_keep_ = j + 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    const int n_keep = static_cast<int>(n_keep_);
+    const int n_left = n_past_ - n_keep;
+    int n_discard = config_.n_discard > 0 ? config_.n_discard : n_left / 2;
+    n_discard =
+      std::max(n_discard, n_past_ + n_tokens - (int)llama_n_ctx(ctx_));
+    if (n_discard > n_left) {
+        return false;
+    }
+
+    llama_memory_seq_rm(mem, 0, n_keep, n_keep + n_discard);
+    llama_memory_seq_add(mem, 0, n_keep + n_discard, n_past_, -n_discard);
+
+    if (draft_ctx_ != nullptr) {
+        // Shift the draft cache the same way rather than re-prefilling it
+        llama_memory_t draft_mem = llama_get_memory(draft_ctx_);
+        const size_t n_end = n_keep_ + n_discard;
+        if (draft_processed_.size() >= n_end &&
+            llama_memory_can_shift(draft_mem)) {
+            llama_memory_seq_rm(draft_mem, 0, n_keep, n_keep + n_discard);
+            llama_memory_seq_add(
+              draft_mem, 0, n_keep + n_discard, -1, -n_discard);
+            draft_processed_.erase(draft_processed_.begin() + n_keep,
+                                   draft_processed_.begin() + n_end);
+        } else {
+            const size_t n_valid = std::min(draft_processed_.size(), n_keep_);
+            llama_memory_seq_rm(draft_mem, 0, n_valid, -1);
+            draft_processed_.resize(n_valid);
+        }
+    }
+
+    auto first = processed_tokens_.begin() + n_keep;
+    discarded_tokens_.insert(
+      discarded_tokens_.end(), first, first + n_discard);
+    processed_tokens_.erase(first, first + n_discard);
+    n_past_ -= n_discard;
+    stats_.n_context_shifts++;
+    return true;
+}
+
+llama_sampler*
+Model::get_sampler(const SamplingParams& params)
+{
+    std::string key = sampler_cache_key(params);
+    auto it = sampler_cache_.find(key);
+    if (it != sampler_cache_.end()) {
+        return it->second;
+    }
+
+    if (sampler_cache_.size() >= SAMPLER_CACHE_MAX_ENTRIES) {
+        for (auto& [cached_key, cached] : sampler_cache_) {
+            llama_sampler_free(cached);
+        }
+        sampler_cache_.clear();
+    }
+    llama_sampler* sampler = make_sampler_chain(params, weights_->get_vocab());
+    sampler_cache_.emplace(std::move(key), sampler);
+    return sampler;
+}
+
+void
+Model::emit_token(llama_token token,
+                  StreamBuffer& stream,
+                  std::string& response)
+{
+    if (stats_.n_generated_tokens++ == 0) {
+        stats_.ttft_ms = elapsed_ms(generate_start_);
+    }
+    const std::string_view piece = weights_->token_to_piece(token);
+    stream.add(piece);
+    response += piece;
+}
+
+size_t
+Model::restore_from_prompt_cache(const std::vector<llama_token>& all_tokens,
+                                 size_t common_prefix)
+{
+    if (all_tokens.empty()) {
+        return common_prefix;
+    }
+
+    if (processed_tokens_.size() >= common_prefix + PROMPT_CACHE_MIN_DISCARD) {
+        std::vector<uint8_t> state(llama_state_seq_get_size(ctx_, 0));
+        const size_t n_written =
+          llama_state_seq_get_data(ctx_, state.data(), state.size(), 0);
+        if (n_written > 0) {
+            state.resize(n_written);
+            prompt_cache_->insert(processed_tokens_, std::move(state));
+        }
+    }
+
+    auto match = prompt_cache_->lookup(all_tokens);
+    // Keep at least one prompt token to decode so there are fresh logits
+    const size_t n_usable =
+      std::min(match.n_matched, all_tokens.size() - 1);
+    if (match.state == nullptr || n_usable <= common_prefix) {
+        return common_prefix;
+    }
+
+    llama_memory_t mem = llama_get_memory(ctx_);
+    llama_memory_seq_rm(mem, 0, -1, -1);
+    if (llama_state_seq_set_data(
+          ctx_, match.state->data(), match.state->size(), 0) == 0) {
+        // The state could not be applied; fall back to a full prefill
+        llama_memory_seq_rm(mem, 0, -1, -1);
+        processed_tokens_.clear();
+        n_past_ = 0;
+        return 0;
+    }
+
+    processed_tokens_ = std::move(match.tokens);
+    n_past_ = static_cast<int>(processed_tokens_.size());
+    return n_usable;
+}
+
+std::optional<SequenceState>
+Model::export_state()
+{
+    if (!discarded_tokens_.empty()) {
+        return std::nullopt;
+    }
+
+    SequenceState state;
+    state.key = weights_->cache_key(config_, 0);
+    state.tokens = processed_tokens_;
+    state.data.resize(llama_state_seq_get_size(ctx_, 0));
+    const size_t n_written =
+      llama_state_seq_get_data(ctx_, state.data.data(), state.data.size(), 0);
+    if (n_written == 0) {
+        return std::nullopt;
+    }
+    state.data.resize(n_written);
+    return state;
+}
+
 bool
-Model::save_cache(const std::string& cache_path)
+Model::import_state(const SequenceState& state)
 {
-    return llama_state_save_file(ctx_,
-                                 cache_path.c_str(),
-                                 processed_tokens_.data(),
-                                 processed_tokens_.size());
+    if (state.key != weights_->cache_key(config_, 0) ||
+        state.tokens.size() > llama_n_ctx(ctx_)) {
+        return false;
+    }
+
+    llama_memory_seq_rm(llama_get_memory(ctx_), 0, -1, -1);
+    if (llama_state_seq_set_data(
+          ctx_, state.data.data(), state.data.size(), 0) == 0) {
+        set_cache_state({});
+        return false;
+    }
+    set_cache_state(state.tokens);
+    return true;
+}
+
+bool
+Model::checkpoint()
+{
+    // A shifted cache holds positions a plain prefill would not produce
+    if (!checkpoint_writer_ || !discarded_tokens_.empty()) {
+        return false;
+    }
+    last_checkpoint_ = std::chrono::steady_clock::now();
+    return checkpoint_writer_->snapshot(ctx_, 0, processed_tokens_);
+}
+
+bool
+Model::flush_checkpoints()
+{
+    return checkpoint_writer_ ? checkpoint_writer_->flush() : true;
+}
+
+bool
+Model::save_cache(const std::string& cache_path, uint64_t tools_hash)
+{
+    // A shifted cache holds positions a plain prefill would not produce
+    if (!discarded_tokens_.empty()) {
+        return false;
+    }
+    return CacheFile::save(cache_path,
+                           weights_->cache_key(config_, tools_hash),
+                           ctx_,
+                           { { 0, &processed_tokens_ } });
 }
 
 std::vector<llama_token>
-Model::load_cache(const std::string& cache_path)
+Model::load_cache(const std::string& cache_path, uint64_t tools_hash)
 {
-    // Start with a reasonable capacity, will be resized based on actual count
-    std::vector<llama_token> tokens(llama_n_ctx(ctx_));
-    size_t n_token_count_out = 0;
+    auto file =
+      CacheFile::open(cache_path, weights_->cache_key(config_, tools_hash));
+    if (!file || file->n_sequences() != 1) {
+        return {};
+    }
+
+    std::vector<llama_token> tokens = file->tokens(0);
+    if (tokens.size() > llama_n_ctx(ctx_)) {
+        return {};
+    }
 
-    if (!llama_state_load_file(ctx_,
-                               cache_path.c_str(),
-                               tokens.data(),
-                               tokens.capacity(),
-                               &n_token_count_out)) {
+    llama_memory_seq_rm(llama_get_memory(ctx_), 0, -1, -1);
+    if (!file->load_sequence(0, ctx_, 0)) {
+        set_cache_state({});
         return {};
     }
 
-    tokens.resize(n_token_count_out);
     set_cache_state(tokens);
     return tokens;
 }
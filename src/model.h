@@ -1,27 +1,114 @@
 #pragma once
 
+#include "cache_file.h"
+#include "cancellation.h"
 #include "chat.h"
+#include "checkpoint_writer.h"
+#include "incremental_tokenizer.h"
 #include "llama.h"
+#include "prompt_cache.h"
 #include <algorithm>
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace agent_cpp {
 
 // Callback for streaming response chunks
 using ResponseCallback = std::function<void(const std::string& chunk)>;
 
-// Model configuration with sensible defaults
-struct ModelConfig
+// Callback for tool calls reported while the response is still streaming
+using ToolCallCallback =
+  std::function<void(const common_chat_tool_call& tool_call)>;
+
+// Sampling settings. ModelConfig holds a model's defaults; GenerateOptions
+// can replace them for a single call.
+struct SamplingParams
 {
     float min_p = 0.0F;
     float top_p = 1.0F;
     int top_k = 0;
     float temp = 0.0F;
     uint32_t seed = LLAMA_DEFAULT_SEED;
+    float typical_p = 1.0F; // 1.0 disables locally typical sampling
+    // Penalties on tokens among the last penalty_last_n sampled ones
+    int penalty_last_n = 64;
+    float penalty_repeat = 1.0F; // 1.0 disables
+    float penalty_freq = 0.0F;
+    float penalty_present = 0.0F;
+    // Mirostat 1 or 2 replaces top-k, typical, top-p and min-p (0 disables)
+    int mirostat = 0;
+    float mirostat_tau = 5.0F;
+    float mirostat_eta = 0.1F;
+    // Added to the logits of single tokens; -INFINITY bans a token
+    std::vector<llama_logit_bias> logit_bias;
+};
+
+// Token counts and timings of one generation call
+struct GenerationStats
+{
+    int n_prompt_tokens = 0;    // Tokens in the prompt
+    int n_cached_tokens = 0;    // Prompt tokens reused from the KV cache
+    int n_prefill_tokens = 0;   // Prompt tokens decoded for this call
+    int n_generated_tokens = 0; // Tokens sampled, end-of-generation excluded
+    int n_draft_tokens = 0;     // Speculative drafts proposed
+    int n_draft_accepted = 0;   // Speculative drafts that matched
+    int n_context_shifts = 0;   // Times the context overflowed and shifted
+    double prompt_ms = 0;  // Chat template rendering and tokenization
+    double prefill_ms = 0; // Until the prompt was in the KV cache
+    double decode_ms = 0;  // From the end of prefill to the last token
+    double ttft_ms = 0;    // From the start of the call to the first token
+
+    [[nodiscard]] double prefill_tokens_per_second() const
+    {
+        return prefill_ms > 0 ? n_prefill_tokens * 1000.0 / prefill_ms : 0;
+    }
+
+    [[nodiscard]] double decode_tokens_per_second() const
+    {
+        return decode_ms > 0 ? n_generated_tokens * 1000.0 / decode_ms : 0;
+    }
+};
+
+// Optional per-call settings for IModel::generate
+struct GenerateOptions
+{
+    // Called with each tool call as soon as its arguments are complete, in
+    // order and at most once per call, so the caller can start executing it
+    // while the model is still generating. The returned message still holds
+    // every tool call. Models that cannot detect calls early never call it.
+    ToolCallCallback on_tool_call = nullptr;
+    // Checked between decode steps; generation throws CancelledError once it
+    // is cancelled
+    std::shared_ptr<CancellationToken> cancellation = nullptr;
+    // Sampling for this call instead of the model's defaults. A local Model
+    // keeps the sampler chains it built, so alternating settings is free.
+    std::optional<SamplingParams> sampling = std::nullopt;
+    // Filled with the call's GenerationStats when set. Models that do not
+    // measure leave it untouched.
+    GenerationStats* stats = nullptr;
+};
+
+class ModelWeights;
+class StreamBuffer;
+
+// What a Model does when a prompt or response no longer fits in n_ctx
+enum class ContextOverflow
+{
+    Error, // Throw ModelError("context size exceeded")
+    Shift, // Discard the oldest tokens after the first n_keep and continue
+};
+
+// Model configuration with sensible defaults
+// The inherited sampling settings are used by calls that do not override them
+struct ModelConfig : SamplingParams
+{
     // When nullopt (default), the format is auto-detected from the model's chat
     // template.
     std::optional<common_chat_format> chat_format = std::nullopt;
@@ -33,8 +120,104 @@ struct ModelConfig
       static_cast<int>(std::max(1u, std::thread::hardware_concurrency() - 1));
     ggml_type cache_type_k = GGML_TYPE_F16;
     ggml_type cache_type_v = GGML_TYPE_F16;
+    // Flash attention; auto lets llama.cpp use it where the backend supports
+    // it. A quantized V cache needs it enabled.
+    llama_flash_attn_type flash_attn = LLAMA_FLASH_ATTN_TYPE_AUTO;
+    // Byte budget for saved KV states of other conversations (0 disables).
+    // When a new prompt diverges from the KV cache, the current state is kept
+    // in a radix tree and the best-matching saved state is restored instead
+    // of prefilling from the divergence point.
+    size_t prompt_cache_bytes = 0;
+    // Speculative decoding: a smaller model with the same vocabulary drafts up
+    // to n_draft tokens, which the main model verifies in one batched decode.
+    // Output is identical to normal decoding; only the number of decode calls
+    // changes. Disabled when draft_weights is null or n_draft <= 0.
+    std::shared_ptr<ModelWeights> draft_weights = nullptr;
+    int n_draft = 8;
+    // Prompt-lookup decoding, used when no draft model is set: the last
+    // lookup_ngram_size tokens are searched for earlier in the context and up
+    // to n_draft tokens that followed them are verified as drafts. Costs no
+    // extra memory and pays off when the output copies earlier text (tool
+    // results, file contents). 0 disables.
+    int lookup_ngram_size = 0;
+    // Constrain sampling with the grammar that the chat template derives from
+    // the tool schemas, so tool calls always parse. Text before a tool call
+    // stays free when the format triggers the grammar lazily. The compiled
+    // grammar is cached per tool set.
+    bool constrain_tool_calls = false;
+    // With ContextOverflow::Shift, a full context drops n_discard tokens right
+    // after the first n_keep and shifts the rest down with
+    // llama_memory_seq_add, so generation continues without re-prefilling.
+    // n_keep = -1 keeps everything up to the end of the first message (the
+    // system prompt and tools); n_discard = 0 drops half of the rest. Later
+    // prompts that repeat the dropped tokens still reuse the cache.
+    ContextOverflow context_overflow = ContextOverflow::Error;
+    int n_keep = -1;
+    int n_discard = 0;
+    // Streamed text reaches the response callback in chunks of at least
+    // stream_min_bytes, or whatever arrived within stream_max_delay_ms. With
+    // both 0 every token is passed on. A multi-byte character split across
+    // tokens is always passed on whole.
+    size_t stream_min_bytes = 0;
+    int stream_max_delay_ms = 0;
+    // Background checkpoints: with checkpoint_path set, a Model snapshots its
+    // KV cache after generate calls, at most once per checkpoint_interval_ms
+    // (0: after every call), and writes it to that file on a background
+    // thread. Each snapshot copies the whole sequence state on the calling
+    // thread, so short intervals add that copy to every turn. A Model
+    // created with the path of a matching checkpoint starts from it, so a
+    // restarted worker resumes the conversation without prefilling it
+    // again. ModelPool appends ".<index>" per context; InferenceEngine
+    // sessions do not checkpoint.
+    std::string checkpoint_path;
+    int checkpoint_interval_ms = 30000;
 };
 
+// Memory limits for ModelWeights::plan_contexts
+struct MemoryBudget
+{
+    size_t bytes = 0;     // Memory for the contexts, weights excluded
+    int n_contexts = 1;   // Contexts (Models or engine sessions) held at once
+    int min_n_ctx = 2048; // Smallest context size worth running
+    int max_n_ctx = 0;    // Largest useful context size, 0 for n_ctx_train
+    // Compute buffers, logits and other per-context memory besides the KV
+    // cache. The default is a rough allowance; measure for large vocabularies
+    // or when running without flash attention.
+    size_t overhead_bytes_per_context = size_t(64) << 20;
+    // Whether the contexts may run with flash attention. Without it only
+    // the K cache is quantized and V stays f16.
+    bool flash_attn = true;
+};
+
+// Context size and KV cache type chosen by ModelWeights::plan_contexts
+struct ContextPlan
+{
+    bool fits = false; // False if even min_n_ctx at q4_0 exceeds the budget
+    int n_ctx = 0;
+    ggml_type cache_type_k = GGML_TYPE_F16;
+    ggml_type cache_type_v = GGML_TYPE_F16; // Quantized only with flash_attn
+    size_t kv_bytes_per_context = 0;
+    size_t bytes_per_context = 0; // Including the overhead
+    int max_contexts = 0;         // Contexts of this size the budget holds
+
+    // Set n_ctx and the KV cache types of a config, and turn on flash
+    // attention if the V cache is quantized
+    void apply(ModelConfig& config) const
+    {
+        config.n_ctx = n_ctx;
+        config.cache_type_k = cache_type_k;
+        config.cache_type_v = cache_type_v;
+        if (ggml_is_quantized(cache_type_v)) {
+            config.flash_attn = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+        }
+    }
+};
+
+// Build the sampler chain described by SamplingParams (or a ModelConfig)
+// The caller owns the returned sampler and must free it with llama_sampler_free
+llama_sampler*
+make_sampler_chain(const SamplingParams& params, const llama_vocab* vocab);
+
 // Forward declaration
 class Model;
 
@@ -49,7 +232,8 @@ class IModel
 
     virtual common_chat_msg generate(const std::vector<common_chat_msg>& messages,
                                      const std::vector<common_chat_tool>& tools,
-                                     const ResponseCallback& callback = nullptr) = 0;
+                                     const ResponseCallback& callback = nullptr,
+                                     const GenerateOptions& options = {}) = 0;
 
     [[nodiscard]] virtual bool supports_prompt_cache() const { return false; }
 
@@ -68,11 +252,40 @@ class IModel
     {
         return {};
     }
-    virtual bool save_cache(const std::string& /*cache_path*/) { return false; }
-    virtual std::vector<llama_token> load_cache(const std::string& /*cache_path*/)
+    // tools_hash identifies the instructions and tools the cached prefix was
+    // rendered from; load_cache rejects a file saved with another one
+    virtual bool save_cache(const std::string& /*cache_path*/,
+                            uint64_t /*tools_hash*/ = 0)
+    {
+        return false;
+    }
+    virtual std::vector<llama_token> load_cache(
+      const std::string& /*cache_path*/,
+      uint64_t /*tools_hash*/ = 0)
     {
         return {};
     }
+    // Hash of what a saved KV state depends on besides its tokens (weights,
+    // chat template, KV cache types). Used to name cache files.
+    [[nodiscard]] virtual uint64_t cache_fingerprint() const { return 0; }
+
+    // Detach the KV cache of the current conversation, to move it to another
+    // model or process, or to park it while the session is idle.
+    // Returns nullopt if the model has no KV cache of its own to export.
+    virtual std::optional<SequenceState> export_state() { return std::nullopt; }
+
+    // Replace the KV cache with an exported state; the next generate then
+    // only prefills what follows its tokens. Returns false if the state came
+    // from other weights or KV cache types, or does not fit.
+    virtual bool import_state(const SequenceState& /*state*/) { return false; }
+
+    // Prefill a prompt prefix once so that other sessions on the same shared
+    // context can fork it instead of decoding it again.
+    // Returns false when the model has no shared context.
+    virtual bool share_prefix(const std::vector<llama_token>& /*tokens*/)
+    {
+        return false;
+    }
 };
 
 
@@ -117,11 +330,64 @@ class ModelWeights
         return llama_model_get_vocab(model_);
     }
 
+    /// @brief Text of a token as it is streamed, special tokens included
+    /// @param token Token id in the vocabulary
+    /// @return View into a table built once when the weights are loaded
+    [[nodiscard]] std::string_view token_to_piece(llama_token token) const
+    {
+        return std::string_view(piece_data_)
+          .substr(piece_offsets_[token],
+                  piece_offsets_[token + 1] - piece_offsets_[token]);
+    }
+
+    /// @brief Hash identifying the weights, for rejecting stale KV caches
+    /// Covers the file size and its first and last MiB, so it is cheap even
+    /// for multi-GB files
+    [[nodiscard]] uint64_t fingerprint() const { return fingerprint_; }
+
+    /// @brief Hash of the chat template source
+    [[nodiscard]] uint64_t template_fingerprint() const
+    {
+        return template_fingerprint_;
+    }
+
+    /// @brief Key for cache files saved from a context of these weights
+    /// @param config Configuration of the context (for the KV cache types)
+    /// @param tools_hash Hash of the instructions and tools, 0 if none
+    [[nodiscard]] CacheFileKey cache_key(const ModelConfig& config,
+                                         uint64_t tools_hash) const;
+
+    /// @brief KV cache memory of one context of these weights
+    /// Counts every layer, so it is an upper bound for sliding-window and
+    /// hybrid models; recurrent models report 0 as their state does not
+    /// grow with n_ctx
+    [[nodiscard]] size_t kv_cache_bytes(int n_ctx,
+                                        ggml_type type_k,
+                                        ggml_type type_v) const;
+
+    /// @brief Choose n_ctx and the KV cache type so that budget.n_contexts
+    /// contexts fit in budget.bytes
+    ///
+    /// Prefers the full context size over precision, and q8_0 over q4_0:
+    /// f16 at max_n_ctx, then q8_0 at the largest n_ctx down to min_n_ctx,
+    /// then q4_0. V is quantized along with K only if budget.flash_attn is
+    /// set, since quantized V caches need flash attention.
+    [[nodiscard]] ContextPlan plan_contexts(const MemoryBudget& budget) const;
+
   private:
     ModelWeights() = default;
 
+    // Fill the piece table from the vocabulary
+    void initialize_pieces();
+
     llama_model* model_ = nullptr;
     std::shared_ptr<common_chat_templates> templates_;
+    std::string piece_data_;            // Every token's text, concatenated
+    std::vector<size_t> piece_offsets_; // n_vocab + 1 offsets into it
+    uint64_t fingerprint_ = 0;
+    uint64_t template_fingerprint_ = 0;
+    int64_t n_embd_k_gqa_ = 0; // K values per token and layer
+    int64_t n_embd_v_gqa_ = 0; // V values per token and layer
 };
 
 // Model interface - encapsulates context and text generation
@@ -166,7 +432,8 @@ class Model : public IModel
     // Returns parsed message with role set to "assistant"
     common_chat_msg generate(const std::vector<common_chat_msg>& messages,
                              const std::vector<common_chat_tool>& tools,
-                             const ResponseCallback& callback = nullptr) override;
+                             const ResponseCallback& callback = nullptr,
+                             const GenerateOptions& options = {}) override;
 
     // Generate text from pre-tokenized input, only processing new tokens
     // Uses KV cache efficiently by tracking previously processed tokens
@@ -195,20 +462,55 @@ class Model : public IModel
     // Get the context for KV cache management
     [[nodiscard]] llama_context* get_context() const { return ctx_; }
 
+    // Get the tokens currently held in the KV cache
+    [[nodiscard]] const std::vector<llama_token>& get_processed_tokens() const
+    {
+        return processed_tokens_;
+    }
+
+    // Get the stats of the last generate or generate_from_tokens call
+    [[nodiscard]] const GenerationStats& get_last_stats() const
+    {
+        return stats_;
+    }
+
     // Get the shared weights (for creating additional Model instances)
     [[nodiscard]] std::shared_ptr<ModelWeights> get_weights() const
     {
         return weights_;
     }
 
-    // Save the current KV cache state (processed_tokens) to a file
+    // Save the current KV cache state (processed_tokens) to a CacheFile
     // Returns true on success, false on failure
-    bool save_cache(const std::string& cache_path) override;
+    bool save_cache(const std::string& cache_path,
+                    uint64_t tools_hash = 0) override;
+
+    // Load KV cache state from a CacheFile
+    // Returns the tokens that were cached, or empty vector if the file is
+    // missing, stale (other weights, template, tools or KV types) or does
+    // not fit in the context. The loaded state will be applied to the context
+    std::vector<llama_token> load_cache(const std::string& cache_path,
+                                        uint64_t tools_hash = 0) override;
 
-    // Load KV cache state from a file
-    // Returns the tokens that were cached, or empty vector on failure
-    // The loaded state will be applied to the context
-    std::vector<llama_token> load_cache(const std::string& cache_path) override;
+    [[nodiscard]] uint64_t cache_fingerprint() const override
+    {
+        return weights_->cache_key(config_, 0).hash();
+    }
+
+    // Export the KV cache; nullopt after a context shift, whose positions a
+    // plain prefill of the tokens would not reproduce
+    std::optional<SequenceState> export_state() override;
+
+    bool import_state(const SequenceState& state) override;
+
+    // Snapshot the KV cache to ModelConfig::checkpoint_path now, e.g. when
+    // the conversation goes idle; the file is written in the background.
+    // Returns false without a checkpoint_path or after a context shift.
+    bool checkpoint();
+
+    // Wait until pending checkpoints are on disk
+    // Returns false if the last write failed
+    bool flush_checkpoints();
 
   private:
     // Set the internal cache state (used when loading from prompt cache)
@@ -216,17 +518,83 @@ class Model : public IModel
     {
         processed_tokens_ = tokens;
         n_past_ = static_cast<int>(tokens.size());
+        discarded_tokens_.clear();
     }
     Model() = default;
 
     void initialize_context(const ModelConfig& model_config);
 
+    // Swap the KV cache to the saved state sharing the longest prefix with
+    // all_tokens, parking the current state first. Returns the new common
+    // prefix length.
+    size_t restore_from_prompt_cache(const std::vector<llama_token>& all_tokens,
+                                     size_t common_prefix);
+
+    // Create the draft context for speculative decoding
+    // Throws ModelError if the draft vocabulary does not match the main model
+    void initialize_draft(const ModelConfig& model_config);
+
+    // Decode loop that verifies draft tokens in batches; same output as the
+    // one-token-per-decode loop in generate_from_tokens
+    std::string generate_speculative(StreamBuffer& stream);
+
+    // Propose up to n_max tokens continuing processed_tokens_ + id_last, from
+    // the draft model if there is one, otherwise by prompt lookup
+    std::vector<llama_token> propose_draft(llama_token id_last, int n_max);
+
+    // Greedily draft up to n_max tokens with the draft model
+    std::vector<llama_token> draft_tokens(llama_token id_last, int n_max);
+
+    // Sample from the logits at output idx, honouring the active grammar
+    llama_token sample_token(int idx);
+
+    // Copy of the compiled tool-call grammar for a chat template result,
+    // compiled and cached on first use. Caller frees the returned sampler.
+    llama_sampler* make_grammar(const common_chat_params& params);
+
+    // Length of the common prefix of all_tokens and the conversation the KV
+    // cache holds, counting tokens dropped by context shifts. Drops the shift
+    // state when all_tokens diverges before the end of the dropped range.
+    size_t match_processed_tokens(const std::vector<llama_token>& all_tokens);
+
+    // Drop tokens after the first n_keep_ so that n_tokens more fit, and shift
+    // the rest of the KV cache down. Returns false if the overflow policy or
+    // the KV cache does not allow it, or if n_tokens cannot fit.
+    bool shift_context(int n_tokens);
+
+    // Sampler chain for params, built and cached on first use
+    // The chain stays owned by the cache
+    llama_sampler* get_sampler(const SamplingParams& params);
+
+    // Append a sampled token's text to the response and stream it
+    void emit_token(llama_token token,
+                    StreamBuffer& stream,
+                    std::string& response);
+
     std::shared_ptr<ModelWeights> weights_;
     llama_context* ctx_ = nullptr;
-    llama_sampler* sampler_ = nullptr;
+    llama_sampler* sampler_ = nullptr; // Chain of current generate, cached
     std::vector<llama_token> processed_tokens_; // Track tokens in KV cache
     int n_past_ = 0;                            // Track position in KV cache
     ModelConfig config_;
+    std::unique_ptr<PromptCache> prompt_cache_; // Other conversations' states
+    IncrementalTokenizer prompt_tokenizer_;     // Last prompt and its tokens
+    llama_context* draft_ctx_ = nullptr;        // Draft model context
+    llama_sampler* draft_sampler_ = nullptr;    // Greedy sampler for drafts
+    std::vector<llama_token> draft_processed_;  // Tokens in the draft KV cache
+    llama_batch spec_batch_{};                  // Token + drafts to verify
+    llama_batch prefill_batch_{};               // Prompt chunk being decoded
+    llama_sampler* grammar_ = nullptr;          // Grammar of current generate
+    std::shared_ptr<CancellationToken> cancellation_; // Of current generate
+    std::unordered_map<std::string, llama_sampler*> grammar_cache_; // Per tools
+    std::unordered_map<std::string, llama_sampler*> sampler_cache_; // Chains
+    std::vector<llama_token_data> candidates_;  // Scratch for grammar sampling
+    size_t n_keep_ = 0; // Tokens kept at the start by context shifts
+    std::vector<llama_token> discarded_tokens_; // Dropped after n_keep_
+    GenerationStats stats_;                     // Of the last generate
+    std::chrono::steady_clock::time_point generate_start_; // Of stats_
+    std::unique_ptr<CheckpointWriter> checkpoint_writer_;
+    std::chrono::steady_clock::time_point last_checkpoint_;
 };
 
 } // namespace agent_cpp
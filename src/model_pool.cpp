@@ -0,0 +1,150 @@
+#include "model_pool.h"
+#include "error.h"
+
+namespace agent_cpp {
+
+namespace {
+
+// One conversation: renders the prompt to pick a context, then generates on
+// it. The conversation's KV state only survives in a context until another
+// conversation is routed there.
+class PooledModel : public IModel
+{
+  public:
+    explicit PooledModel(std::shared_ptr<ModelPool> pool)
+      : pool_(std::move(pool))
+    {
+    }
+
+    common_chat_msg generate(const std::vector<common_chat_msg>& messages,
+                             const std::vector<common_chat_tool>& tools,
+                             const ResponseCallback& callback = nullptr,
+                             const GenerateOptions& options = {}) override
+    {
+        auto weights = pool_->get_weights();
+
+        common_chat_templates_inputs inputs;
+        inputs.messages = messages;
+        inputs.tools = tools;
+        inputs.tool_choice = COMMON_CHAT_TOOL_CHOICE_AUTO;
+        inputs.add_generation_prompt = true;
+        inputs.enable_thinking = false;
+
+        // The leased Model renders and tokenizes the prompt again: it needs
+        // the template output for its grammar and parser, and adds BOS only
+        // if its own context is empty. Rendering is cheap next to prefill.
+        auto params =
+          common_chat_templates_apply(weights->get_templates(), inputs);
+        const std::vector<llama_token>& tokens = routing_tokenizer_.tokenize(
+          weights->get_vocab(), params.prompt, false);
+
+        auto model = pool_->acquire(tokens);
+        return model->generate(messages, tools, callback, options);
+    }
+
+    [[nodiscard]] common_chat_templates* get_templates() const override
+    {
+        return pool_->get_weights()->get_templates();
+    }
+
+  private:
+    std::shared_ptr<ModelPool> pool_;
+    IncrementalTokenizer routing_tokenizer_;
+};
+
+} // anonymous namespace
+
+size_t
+shared_prefix_length(const std::vector<llama_token>& cached,
+                     const std::vector<llama_token>& prompt,
+                     llama_token bos)
+{
+    size_t i = !cached.empty() && cached[0] == bos ? 1 : 0;
+    size_t j = !prompt.empty() && prompt[0] == bos ? 1 : 0;
+    size_t n = 0;
+    while (i + n < cached.size() && j + n < prompt.size() &&
+           cached[i + n] == prompt[j + n]) {
+        n++;
+    }
+    return n;
+}
+
+std::shared_ptr<ModelPool>
+ModelPool::create(std::shared_ptr<ModelWeights> weights,
+                  const ModelConfig& model_config,
+                  int n_contexts)
+{
+    if (n_contexts < 1) {
+        throw ModelError("model pool needs at least one context");
+    }
+
+    std::shared_ptr<ModelPool> pool(new ModelPool());
+    pool->weights_ = std::move(weights);
+    pool->entries_.resize(n_contexts);
+    for (size_t i = 0; i < pool->entries_.size(); i++) {
+        // Each context checkpoints its own conversation
+        ModelConfig config = model_config;
+        if (!config.checkpoint_path.empty()) {
+            config.checkpoint_path += "." + std::to_string(i);
+        }
+        pool->entries_[i].model =
+          Model::create_with_weights(pool->weights_, config);
+    }
+    return pool;
+}
+
+std::shared_ptr<Model>
+ModelPool::acquire(const std::vector<llama_token>& tokens)
+{
+    const llama_token bos = llama_vocab_bos(weights_->get_vocab());
+    std::unique_lock<std::mutex> lock(mutex_);
+    size_t best = entries_.size();
+    cv_.wait(lock, [&] {
+        size_t best_shared = 0;
+        best = entries_.size();
+        for (size_t i = 0; i < entries_.size(); i++) {
+            const Entry& entry = entries_[i];
+            if (entry.leased) {
+                continue;
+            }
+            const size_t shared = shared_prefix_length(
+              entry.model->get_processed_tokens(), tokens, bos);
+            // Longest shared prefix wins; ties (including no match at all)
+            // go to the least recently used context
+            if (best == entries_.size() || shared > best_shared ||
+                (shared == best_shared &&
+                 entry.last_used < entries_[best].last_used)) {
+                best = i;
+                best_shared = shared;
+            }
+        }
+        return best < entries_.size();
+    });
+
+    Entry& entry = entries_[best];
+    entry.leased = true;
+    entry.last_used = ++clock_;
+
+    // Alias the pool's Model; dropping the last copy returns it to the pool
+    auto self = shared_from_this();
+    return std::shared_ptr<Model>(
+      entry.model.get(), [self, best](Model*) { self->release(best); });
+}
+
+std::shared_ptr<IModel>
+ModelPool::create_model()
+{
+    return std::make_shared<PooledModel>(shared_from_this());
+}
+
+void
+ModelPool::release(size_t index)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_[index].leased = false;
+    }
+    cv_.notify_one();
+}
+
+} // namespace agent_cpp
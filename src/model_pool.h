@@ -0,0 +1,97 @@
+#pragma once
+
+#include "model.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace agent_cpp {
+
+/// @brief Length of the prefix a context's cached tokens share with a prompt
+/// @param cached Tokens in the context's KV cache
+/// @param prompt Prompt tokens about to be generated from
+/// @param bos The vocabulary's BOS token
+///
+/// A leading BOS is skipped on either side: a Model adds it only to the first
+/// prompt of an empty context, so later turns are tokenized without it.
+size_t
+shared_prefix_length(const std::vector<llama_token>& cached,
+                     const std::vector<llama_token>& prompt,
+                     llama_token bos);
+
+/// @brief Fixed set of Model contexts over shared weights, routed by prefix.
+///
+/// Each Model keeps one KV cache described by its processed tokens. acquire()
+/// hands out the idle context whose cached tokens share the longest prefix
+/// with the incoming prompt, so a returning conversation lands on the context
+/// that still holds it; when nothing matches, the least recently used idle
+/// context is reused. Many more conversations than contexts can be served
+/// while maximizing prefix reuse.
+///
+/// create_model() returns an IModel for one conversation that acquires a
+/// context only for the duration of each generate() call, so it can be
+/// handed to an Agent like a Model.
+class ModelPool : public std::enable_shared_from_this<ModelPool>
+{
+  public:
+    /// @brief Create the contexts
+    /// @param weights Shared pointer to ModelWeights
+    /// @param model_config Configuration used for every context
+    /// @param n_contexts Number of Model contexts (KV caches)
+    /// @return Shared pointer to the pool
+    /// @throws agent_cpp::ModelError if context creation fails
+    static std::shared_ptr<ModelPool> create(
+      std::shared_ptr<ModelWeights> weights,
+      const ModelConfig& model_config = ModelConfig{},
+      int n_contexts = 4);
+
+    ModelPool(const ModelPool&) = delete;
+    ModelPool& operator=(const ModelPool&) = delete;
+    ModelPool(ModelPool&&) = delete;
+    ModelPool& operator=(ModelPool&&) = delete;
+
+    /// @brief Lease the idle context best suited for a prompt
+    /// @param tokens Prompt tokens the caller is about to generate from, with
+    /// or without a leading BOS
+    /// @return The context; it returns to the pool when the last copy of the
+    /// pointer is released. Blocks while every context is leased.
+    std::shared_ptr<Model> acquire(const std::vector<llama_token>& tokens);
+
+    /// @brief Create a conversation handle that leases a context per call
+    std::shared_ptr<IModel> create_model();
+
+    /// @brief Number of contexts
+    [[nodiscard]] int n_contexts() const
+    {
+        return static_cast<int>(entries_.size());
+    }
+
+    /// @brief Get the shared weights
+    [[nodiscard]] std::shared_ptr<ModelWeights> get_weights() const
+    {
+        return weights_;
+    }
+
+  private:
+    struct Entry
+    {
+        std::shared_ptr<Model> model;
+        bool leased = false;
+        uint64_t last_used = 0;
+    };
+
+    ModelPool() = default;
+
+    void release(size_t index);
+
+    std::shared_ptr<ModelWeights> weights_;
+    std::vector<Entry> entries_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    uint64_t clock_ = 0;
+};
+
+} // namespace agent_cpp
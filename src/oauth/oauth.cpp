@@ -307,7 +307,39 @@ class OAuthClientImpl : public OAuthClient
         if (token.refresh_token.empty()) {
             return std::nullopt;
         }
+        if (!config_.on_token_refresh) {
+            return request_token_refresh(token);
+        }
+
+        try {
+            auto new_token = request_token_refresh(token);
+            config_.on_token_refresh(new_token.has_value());
+            return new_token;
+        } catch (...) {
+            config_.on_token_refresh(false);
+            throw;
+        }
+    }
+
+    void clear_tokens() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(cached_token_mutex_);
+            cached_token_.reset();
+        }
+        storage_->remove(config_.provider_name);
+    }
+
+    [[nodiscard]] bool has_valid_token() const override
+    {
+        std::lock_guard<std::mutex> lock(cached_token_mutex_);
+        auto token = storage_->load(config_.provider_name);
+        return token && !token->is_expired();
+    }
 
+  private:
+    std::optional<OAuthToken> request_token_refresh(const OAuthToken& token)
+    {
         try {
             std::ostringstream body;
             body << "grant_type=refresh_token";
@@ -356,23 +388,6 @@ class OAuthClientImpl : public OAuthClient
         }
     }
 
-    void clear_tokens() override
-    {
-        {
-            std::lock_guard<std::mutex> lock(cached_token_mutex_);
-            cached_token_.reset();
-        }
-        storage_->remove(config_.provider_name);
-    }
-
-    [[nodiscard]] bool has_valid_token() const override
-    {
-        std::lock_guard<std::mutex> lock(cached_token_mutex_);
-        auto token = storage_->load(config_.provider_name);
-        return token && !token->is_expired();
-    }
-
-  private:
     std::optional<OAuthToken> perform_auth_flow(
       const AuthUrlCallback& auth_url_callback,
       const StatusCallback& status_callback,
@@ -35,6 +35,10 @@ struct OAuthConfig
     std::string scope;
 
     std::string provider_name = "default";
+
+    // Called after each refresh-token request with whether it produced a new
+    // token, e.g. to record metrics
+    std::function<void(bool success)> on_token_refresh;
 };
 
 struct TokenStorageConfig
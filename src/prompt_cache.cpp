@@ -0,0 +1,207 @@
+#include "prompt_cache.h"
+#include <deque>
+
+namespace agent_cpp {
+
+PromptCache::PromptCache(size_t max_bytes)
+  : max_bytes_(max_bytes)
+{
+}
+
+void
+PromptCache::insert(const std::vector<llama_token>& tokens,
+                    std::vector<uint8_t> state)
+{
+    if (tokens.empty() || state.size() > max_bytes_) {
+        return;
+    }
+
+    Node* node = &root_;
+    size_t i = 0;
+    while (i < tokens.size()) {
+        auto it = node->children.find(tokens[i]);
+        if (it == node->children.end()) {
+            auto child = std::make_unique<Node>();
+            child->edge.assign(tokens.begin() + i, tokens.end());
+            child->parent = node;
+            node = (node->children[tokens[i]] = std::move(child)).get();
+            break;
+        }
+
+        Node* child = it->second.get();
+        size_t k = 0;
+        while (k < child->edge.size() && i + k < tokens.size() &&
+               child->edge[k] == tokens[i + k]) {
+            k++;
+        }
+
+        // Split the edge so the new entry ends on a node
+        if (k < child->edge.size()) {
+            auto mid = std::make_unique<Node>();
+            mid->edge.assign(child->edge.begin(), child->edge.begin() + k);
+            mid->parent = node;
+
+            std::unique_ptr<Node> rest = std::move(it->second);
+            rest->edge.erase(rest->edge.begin(), rest->edge.begin() + k);
+            rest->parent = mid.get();
+            mid->children[rest->edge[0]] = std::move(rest);
+
+            it->second = std::move(mid);
+            child = it->second.get();
+        }
+
+        node = child;
+        i += k;
+    }
+
+    if (node->has_state) {
+        size_bytes_ -= node->state.size();
+    } else {
+        node->has_state = true;
+        n_entries_++;
+    }
+    node->state = std::move(state);
+    node->last_used = ++clock_;
+    size_bytes_ += node->state.size();
+
+    evict();
+}
+
+PromptCache::Match
+PromptCache::lookup(const std::vector<llama_token>& tokens)
+{
+    Match match;
+
+    // Walk as far as the query agrees with the tree; every entry below the
+    // last node reached shares the same prefix
+    Node* node = &root_;
+    Node* deepest = nullptr;
+    size_t i = 0;
+    while (i < tokens.size()) {
+        auto it = node->children.find(tokens[i]);
+        if (it == node->children.end()) {
+            break;
+        }
+
+        Node* child = it->second.get();
+        size_t k = 0;
+        while (k < child->edge.size() && i + k < tokens.size() &&
+               child->edge[k] == tokens[i + k]) {
+            k++;
+        }
+
+        i += k;
+        deepest = child;
+        if (k < child->edge.size()) {
+            break;
+        }
+        node = child;
+    }
+
+    if (deepest == nullptr) {
+        return match;
+    }
+
+    Node* entry = find_state_below(deepest);
+    if (entry == nullptr) {
+        return match;
+    }
+
+    entry->last_used = ++clock_;
+    match.n_matched = i;
+    match.tokens = path_tokens(entry);
+    match.state = &entry->state;
+    return match;
+}
+
+void
+PromptCache::clear()
+{
+    root_.children.clear();
+    size_bytes_ = 0;
+    n_entries_ = 0;
+}
+
+void
+PromptCache::evict()
+{
+    while (size_bytes_ > max_bytes_ && n_entries_ > 0) {
+        Node* lru = nullptr;
+        std::deque<Node*> queue{ &root_ };
+        while (!queue.empty()) {
+            Node* node = queue.front();
+            queue.pop_front();
+            if (node->has_state &&
+                (lru == nullptr || node->last_used < lru->last_used)) {
+                lru = node;
+            }
+            for (auto& [token, child] : node->children) {
+                queue.push_back(child.get());
+            }
+        }
+        remove_state(lru);
+    }
+}
+
+void
+PromptCache::remove_state(Node* node)
+{
+    size_bytes_ -= node->state.size();
+    node->state.clear();
+    node->state.shrink_to_fit();
+    node->has_state = false;
+    n_entries_--;
+
+    // Prune leaves that no longer hold a state
+    while (node != &root_ && !node->has_state && node->children.empty()) {
+        Node* parent = node->parent;
+        const llama_token key = node->edge[0];
+        parent->children.erase(key);
+        node = parent;
+    }
+
+    // Merge a stateless node into its only child to keep the tree compressed
+    if (node != &root_ && !node->has_state && node->children.size() == 1) {
+        Node* parent = node->parent;
+        std::unique_ptr<Node> child = std::move(node->children.begin()->second);
+        child->edge.insert(
+          child->edge.begin(), node->edge.begin(), node->edge.end());
+        child->parent = parent;
+        parent->children[child->edge[0]] = std::move(child);
+    }
+}
+
+PromptCache::Node*
+PromptCache::find_state_below(Node* node)
+{
+    // Breadth-first, so the shortest (cheapest to restore) state wins
+    std::deque<Node*> queue{ node };
+    while (!queue.empty()) {
+        Node* current = queue.front();
+        queue.pop_front();
+        if (current->has_state) {
+            return current;
+        }
+        for (auto& [token, child] : current->children) {
+            queue.push_back(child.get());
+        }
+    }
+    return nullptr;
+}
+
+std::vector<llama_token>
+PromptCache::path_tokens(const Node* node)
+{
+    std::vector<const Node*> path;
+    for (const Node* n = node; n->parent != nullptr; n = n->parent) {
+        path.push_back(n);
+    }
+
+    std::vector<llama_token> tokens;
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        tokens.insert(tokens.end(), (*it)->edge.begin(), (*it)->edge.end());
+    }
+    return tokens;
+}
+
+} // namespace agent_cpp
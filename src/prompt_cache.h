@@ -0,0 +1,73 @@
+#pragma once
+
+#include "llama.h"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace agent_cpp {
+
+/// @brief Token-level radix tree of saved KV cache states.
+///
+/// Each entry maps a token sequence to the serialized sequence state that
+/// holds exactly those tokens (llama_state_seq_get_data). lookup() walks the
+/// tree along a new prompt and returns the entry that shares the longest
+/// prefix with it; the caller restores that state and truncates it to the
+/// matched length, so switching between interleaved conversations only
+/// prefills what is new.
+///
+/// Entries are evicted least recently used first once the total size of the
+/// stored states exceeds the byte budget.
+class PromptCache
+{
+  public:
+    struct Match
+    {
+        size_t n_matched = 0;            // Tokens shared with the query
+        std::vector<llama_token> tokens; // Tokens held by the entry's state
+        const std::vector<uint8_t>* state = nullptr; // Valid until next insert
+    };
+
+    explicit PromptCache(size_t max_bytes);
+
+    /// @brief Store the state for a token sequence, replacing any previous
+    /// state for the same tokens, then evict down to the byte budget
+    void insert(const std::vector<llama_token>& tokens,
+                std::vector<uint8_t> state);
+
+    /// @brief Find the entry sharing the longest prefix with tokens
+    /// @return Match with state == nullptr if nothing is shared
+    Match lookup(const std::vector<llama_token>& tokens);
+
+    void clear();
+
+    [[nodiscard]] size_t size_bytes() const { return size_bytes_; }
+    [[nodiscard]] size_t n_entries() const { return n_entries_; }
+    [[nodiscard]] size_t max_bytes() const { return max_bytes_; }
+
+  private:
+    struct Node
+    {
+        std::vector<llama_token> edge; // Tokens from the parent to this node
+        std::map<llama_token, std::unique_ptr<Node>> children;
+        Node* parent = nullptr;
+        bool has_state = false;
+        std::vector<uint8_t> state;
+        uint64_t last_used = 0;
+    };
+
+    void evict();
+    void remove_state(Node* node);
+    static Node* find_state_below(Node* node);
+    static std::vector<llama_token> path_tokens(const Node* node);
+
+    Node root_;
+    size_t max_bytes_;
+    size_t size_bytes_ = 0;
+    size_t n_entries_ = 0;
+    uint64_t clock_ = 0;
+};
+
+} // namespace agent_cpp
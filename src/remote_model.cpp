@@ -2,6 +2,7 @@
 
 #include "error.h"
 
+#include <chrono>
 #include <cstdlib>
 #include <sstream>
 #include <stdexcept>
@@ -152,7 +153,8 @@ RemoteModel::create(const Config& cfg)
 common_chat_msg
 RemoteModel::generate(const std::vector<common_chat_msg>& messages,
                       const std::vector<common_chat_tool>& tools,
-                      const ResponseCallback& callback)
+                      const ResponseCallback& callback,
+                      const GenerateOptions& options)
 {
     // Build request
     json body;
@@ -169,6 +171,22 @@ RemoteModel::generate(const std::vector<common_chat_msg>& messages,
         body["tool_choice"] = "auto";
     }
 
+    // OpenRouter takes llama.cpp-style sampling parameters; typical-p,
+    // mirostat and token logit biases have no portable equivalent
+    if (options.sampling) {
+        const SamplingParams& sampling = *options.sampling;
+        body["temperature"] = sampling.temp;
+        body["top_p"] = sampling.top_p;
+        body["top_k"] = sampling.top_k;
+        body["min_p"] = sampling.min_p;
+        body["repetition_penalty"] = sampling.penalty_repeat;
+        body["frequency_penalty"] = sampling.penalty_freq;
+        body["presence_penalty"] = sampling.penalty_present;
+        if (sampling.seed != LLAMA_DEFAULT_SEED) {
+            body["seed"] = sampling.seed;
+        }
+    }
+
     std::string host;
     std::string base_path;
     parse_url(cfg_.base_url, host, base_path);
@@ -191,6 +209,7 @@ RemoteModel::generate(const std::vector<common_chat_msg>& messages,
         { "X-Title", "agent.cpp" },
     };
 
+    const auto start = std::chrono::steady_clock::now();
     auto res = client.Post(path.c_str(), headers, body.dump(), "application/json");
     if (!res) {
         throw ModelError(std::string("OpenRouter request failed: ") + httplib::to_string(res.error()));
@@ -249,6 +268,28 @@ RemoteModel::generate(const std::vector<common_chat_msg>& messages,
         callback(out.content);
     }
 
+    if (options.stats != nullptr) {
+        // Token counts come from the provider; the whole response arrives at
+        // once, so the only timing is the round trip
+        GenerationStats stats;
+        if (resp.contains("usage") && resp["usage"].is_object()) {
+            const json& usage = resp["usage"];
+            stats.n_prompt_tokens = usage.value("prompt_tokens", 0);
+            stats.n_generated_tokens = usage.value("completion_tokens", 0);
+            if (usage.contains("prompt_tokens_details") &&
+                usage["prompt_tokens_details"].is_object()) {
+                stats.n_cached_tokens =
+                  usage["prompt_tokens_details"].value("cached_tokens", 0);
+            }
+            stats.n_prefill_tokens =
+              stats.n_prompt_tokens - stats.n_cached_tokens;
+        }
+        stats.ttft_ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+        *options.stats = stats;
+    }
+
     return out;
 }
 
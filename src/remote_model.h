@@ -32,7 +32,8 @@ class RemoteModel : public IModel
 
     common_chat_msg generate(const std::vector<common_chat_msg>& messages,
                              const std::vector<common_chat_tool>& tools,
-                             const ResponseCallback& callback = nullptr) override;
+                             const ResponseCallback& callback = nullptr,
+                             const GenerateOptions& options = {}) override;
 
     [[nodiscard]] bool supports_prompt_cache() const override { return false; }
 
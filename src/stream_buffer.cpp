@@ -0,0 +1,80 @@
+#include "stream_buffer.h"
+
+namespace agent_cpp {
+
+size_t
+utf8_complete_length(std::string_view text)
+{
+    const size_t n = text.size();
+    // A sequence is at most 4 bytes, so its lead byte is among the last 4
+    for (size_t k = 1; k <= 4 && k <= n; k++) {
+        const auto c = static_cast<unsigned char>(text[n - k]);
+        if ((c & 0xC0) == 0x80) {
+            continue; // Continuation byte
+        }
+
+        size_t expected = 1;
+        if ((c & 0xE0) == 0xC0) {
+            expected = 2;
+        } else if ((c & 0xF0) == 0xE0) {
+            expected = 3;
+        } else if ((c & 0xF8) == 0xF0) {
+            expected = 4;
+        }
+        return k < expected ? n - k : n;
+    }
+    return n;
+}
+
+StreamBuffer::StreamBuffer(ResponseCallback callback,
+                           size_t min_bytes,
+                           std::chrono::milliseconds max_delay)
+  : callback_(std::move(callback))
+  , min_bytes_(min_bytes)
+  , max_delay_(max_delay)
+  , last_emit_(std::chrono::steady_clock::now())
+{
+}
+
+void
+StreamBuffer::add(std::string_view piece)
+{
+    if (!callback_) {
+        return;
+    }
+    buffer_.append(piece);
+
+    if (min_bytes_ > 0 || max_delay_.count() > 0) {
+        const bool full = min_bytes_ > 0 && buffer_.size() >= min_bytes_;
+        const bool late =
+          max_delay_.count() > 0 &&
+          std::chrono::steady_clock::now() - last_emit_ >= max_delay_;
+        if (!full && !late) {
+            return;
+        }
+    }
+    emit(utf8_complete_length(buffer_));
+}
+
+void
+StreamBuffer::flush()
+{
+    if (callback_) {
+        emit(buffer_.size());
+    }
+}
+
+void
+StreamBuffer::emit(size_t n_bytes)
+{
+    if (n_bytes == 0) {
+        return;
+    }
+
+    std::string chunk = buffer_.substr(0, n_bytes);
+    buffer_.erase(0, n_bytes);
+    last_emit_ = std::chrono::steady_clock::now();
+    callback_(chunk);
+}
+
+} // namespace agent_cpp
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "model.h"
+#include <chrono>
+#include <string>
+#include <string_view>
+
+namespace agent_cpp {
+
+/// @brief Length of the longest prefix of text that does not end inside a
+/// UTF-8 sequence
+/// Invalid bytes count as complete, so they are never held back.
+size_t
+utf8_complete_length(std::string_view text);
+
+/// @brief Coalesces streamed pieces before they reach a response callback.
+///
+/// A multi-byte UTF-8 character split across tokens is held back until its
+/// last byte arrives, so every chunk passed on is valid UTF-8. When
+/// min_bytes or max_delay is set, pieces are also batched until min_bytes
+/// have accumulated or max_delay has passed since the previous chunk. The
+/// delay is checked whenever a piece arrives. With both at zero every
+/// complete piece is passed on right away.
+class StreamBuffer
+{
+  public:
+    StreamBuffer(ResponseCallback callback,
+                 size_t min_bytes = 0,
+                 std::chrono::milliseconds max_delay = {});
+
+    /// @brief Append a piece of generated text
+    void add(std::string_view piece);
+
+    /// @brief Pass on everything still buffered, complete or not
+    void flush();
+
+  private:
+    void emit(size_t n_bytes);
+
+    ResponseCallback callback_;
+    size_t min_bytes_;
+    std::chrono::milliseconds max_delay_;
+    std::chrono::steady_clock::time_point last_emit_;
+    std::string buffer_;
+};
+
+} // namespace agent_cpp
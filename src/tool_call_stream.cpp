@@ -0,0 +1,67 @@
+#include "tool_call_stream.h"
+#include <nlohmann/json.hpp>
+
+namespace agent_cpp {
+
+ToolCallStream::ToolCallStream(const common_chat_syntax& syntax,
+                               ResponseCallback callback,
+                               ToolCallCallback on_tool_call)
+  : syntax_(syntax)
+  , callback_(std::move(callback))
+  , on_tool_call_(std::move(on_tool_call))
+{
+}
+
+void
+ToolCallStream::add(const std::string& chunk)
+{
+    if (callback_) {
+        callback_(chunk);
+    }
+    text_ += chunk;
+
+    // Arguments are JSON objects, so a call can only complete when a
+    // top-level object closes. Quotes outside JSON are ordinary text.
+    bool closed = false;
+    for (char c : chunk) {
+        if (in_string_) {
+            if (escaped_) {
+                escaped_ = false;
+            } else if (c == '\\') {
+                escaped_ = true;
+            } else if (c == '"') {
+                in_string_ = false;
+            }
+        } else if (c == '"' && depth_ > 0) {
+            in_string_ = true;
+        } else if (c == '{') {
+            depth_++;
+        } else if (c == '}' && depth_ > 0) {
+            depth_--;
+            closed = closed || depth_ == 0;
+        }
+    }
+    if (!on_tool_call_ || !closed) {
+        return;
+    }
+
+    common_chat_msg msg;
+    try {
+        msg = common_chat_parse(text_, true, syntax_);
+    } catch (const std::exception&) {
+        return;
+    }
+
+    while (n_reported_ < msg.tool_calls.size()) {
+        const common_chat_tool_call& call = msg.tool_calls[n_reported_];
+        const bool complete = n_reported_ + 1 < msg.tool_calls.size() ||
+                              nlohmann::json::accept(call.arguments);
+        if (!complete || call.name.empty()) {
+            break;
+        }
+        on_tool_call_(call);
+        n_reported_++;
+    }
+}
+
+} // namespace agent_cpp
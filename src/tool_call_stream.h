@@ -0,0 +1,48 @@
+#pragma once
+
+#include "chat.h"
+#include "model.h"
+#include <string>
+
+namespace agent_cpp {
+
+/// @brief Detects completed tool calls in a streaming response.
+///
+/// Forwards every chunk to the wrapped response callback, keeps the text so
+/// far, and re-parses it as a partial message whenever a top-level JSON
+/// object closes. Nested objects and braces inside JSON strings do not
+/// trigger a parse, so the cost grows with the number of calls rather than
+/// the number of chunks. A tool call counts as complete once a later call
+/// has started or its arguments are valid JSON; each complete call is passed
+/// to on_tool_call once, in order.
+class ToolCallStream
+{
+  public:
+    ToolCallStream(const common_chat_syntax& syntax,
+                   ResponseCallback callback,
+                   ToolCallCallback on_tool_call);
+
+    /// @brief Feed the next chunk of generated text
+    void add(const std::string& chunk);
+
+    /// @brief Response callback that feeds this stream
+    /// The stream must outlive the returned callback
+    ResponseCallback as_callback()
+    {
+        return [this](const std::string& chunk) { add(chunk); };
+    }
+
+    [[nodiscard]] size_t n_reported() const { return n_reported_; }
+
+  private:
+    common_chat_syntax syntax_;
+    ResponseCallback callback_;
+    ToolCallCallback on_tool_call_;
+    std::string text_;
+    size_t n_reported_ = 0;
+    int depth_ = 0;          // Brace depth of the JSON being generated
+    bool in_string_ = false; // Inside a JSON string (only when depth_ > 0)
+    bool escaped_ = false;   // Previous string character was a backslash
+};
+
+} // namespace agent_cpp
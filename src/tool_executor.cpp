@@ -0,0 +1,57 @@
+#include "tool_executor.h"
+
+namespace agent_cpp {
+
+ToolExecutor::ToolExecutor(size_t n_threads)
+{
+    n_threads = std::max<size_t>(1, n_threads);
+    workers_.reserve(n_threads);
+    for (size_t i = 0; i < n_threads; i++) {
+        workers_.emplace_back([this]() { run(); });
+    }
+}
+
+ToolExecutor::~ToolExecutor()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+std::future<ToolResult>
+ToolExecutor::submit(std::function<ToolResult()> task)
+{
+    std::packaged_task<ToolResult()> packaged(std::move(task));
+    std::future<ToolResult> future = packaged.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push(std::move(packaged));
+    }
+    cv_.notify_one();
+    return future;
+}
+
+void
+ToolExecutor::run()
+{
+    while (true) {
+        std::packaged_task<ToolResult()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop();
+        }
+        task();
+    }
+}
+
+} // namespace agent_cpp
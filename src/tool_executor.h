@@ -0,0 +1,53 @@
+#pragma once
+
+#include "tool_result.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace agent_cpp {
+
+/// @brief Fixed-size thread pool for running tool calls concurrently.
+///
+/// Pass one to Agent::set_tool_executor to run the tool calls of an assistant
+/// message in parallel. Mostly useful for I/O-bound tools (MCP calls, shell
+/// commands); every tool the agent can call must then be safe to execute
+/// from several threads at once. One executor can be shared by many agents.
+class ToolExecutor
+{
+  public:
+    /// @brief Start the worker threads
+    /// @param n_threads Number of workers (at least one)
+    explicit ToolExecutor(
+      size_t n_threads = std::max(1u, std::thread::hardware_concurrency()));
+
+    /// @brief Finish queued tasks and join the workers
+    ~ToolExecutor();
+
+    ToolExecutor(const ToolExecutor&) = delete;
+    ToolExecutor& operator=(const ToolExecutor&) = delete;
+    ToolExecutor(ToolExecutor&&) = delete;
+    ToolExecutor& operator=(ToolExecutor&&) = delete;
+
+    /// @brief Queue a task; exceptions it throws are rethrown by future::get
+    std::future<ToolResult> submit(std::function<ToolResult()> task);
+
+    [[nodiscard]] size_t n_threads() const { return workers_.size(); }
+
+  private:
+    void run();
+
+    std::vector<std::thread> workers_;
+    std::queue<std::packaged_task<ToolResult()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+};
+
+} // namespace agent_cpp
@@ -0,0 +1,247 @@
+#include "cache_directory.h"
+#include "cache_file.h"
+#include "test_utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using agent_cpp::CacheDirectory;
+using agent_cpp::CacheFile;
+using agent_cpp::CacheFileKey;
+
+namespace {
+
+std::string
+temp_path(const std::string& name)
+{
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+CacheFileKey
+test_key()
+{
+    CacheFileKey key;
+    key.model_hash = 1;
+    key.template_hash = 2;
+    key.tools_hash = 3;
+    key.type_k = 1;
+    key.type_v = 1;
+    return key;
+}
+
+} // namespace
+
+TEST(test_fnv1a_64)
+{
+    // Reference values of 64-bit FNV-1a
+    ASSERT_EQ(agent_cpp::fnv1a_64(""), 0xcbf29ce484222325ULL);
+    ASSERT_EQ(agent_cpp::fnv1a_64("a"), 0xaf63dc4c8601ec8cULL);
+    ASSERT_EQ(agent_cpp::fnv1a_64("b", agent_cpp::fnv1a_64("a")),
+              agent_cpp::fnv1a_64("ab"));
+}
+
+TEST(test_cache_file_checks_key)
+{
+    const std::string path = temp_path("agent_cpp_test_cache.bin");
+    ASSERT_TRUE(CacheFile::save(path, test_key(), nullptr, {}));
+    // The temporary file was renamed into place
+    const auto dir = std::filesystem::path(path).parent_path();
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+        const std::string name = entry.path().filename().string();
+        ASSERT_TRUE(name.rfind("agent_cpp_test_cache.bin.tmp", 0) != 0);
+    }
+
+    auto file = CacheFile::open(path, test_key());
+    ASSERT_TRUE(file != nullptr);
+    ASSERT_EQ(file->n_sequences(), 0U);
+
+    CacheFileKey other = test_key();
+    other.tools_hash = 4;
+    ASSERT_TRUE(CacheFile::open(path, other) == nullptr);
+    other = test_key();
+    other.type_v = 8;
+    ASSERT_TRUE(CacheFile::open(path, other) == nullptr);
+
+    file.reset();
+    std::filesystem::remove(path);
+}
+
+TEST(test_cache_file_rejects_other_files)
+{
+    const std::string path = temp_path("agent_cpp_test_not_a_cache.bin");
+    ASSERT_TRUE(CacheFile::open(path, test_key()) == nullptr);
+
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << "GGSN this is a llama.cpp session file, not a cache file";
+    }
+    ASSERT_TRUE(CacheFile::open(path, test_key()) == nullptr);
+
+    // A valid header whose table runs past the end of the file
+    ASSERT_TRUE(CacheFile::save(path, test_key(), nullptr, {}));
+    {
+        std::fstream io(path, std::ios::binary | std::ios::in | std::ios::out);
+        io.seekp(12); // n_sequences
+        const uint32_t n_sequences = 1000;
+        io.write(reinterpret_cast<const char*>(&n_sequences),
+                 sizeof(n_sequences));
+    }
+    ASSERT_TRUE(CacheFile::open(path, test_key()) == nullptr);
+
+    std::filesystem::remove(path);
+}
+
+TEST(test_cache_file_sequences_round_trip)
+{
+    const std::string path = temp_path("agent_cpp_test_sequences.bin");
+    const std::vector<llama_token> tokens_a = { 1, 2, 3 };
+    const std::vector<llama_token> tokens_b = { 4, 5 };
+    const std::vector<uint8_t> state_a(100, 0xaa);
+    const std::vector<uint8_t> state_b(5000, 0xbb);
+    ASSERT_TRUE(CacheFile::save(path,
+                                test_key(),
+                                nullptr,
+                                { { 0, &tokens_a, &state_a },
+                                  { 7, &tokens_b, &state_b } }));
+
+    auto file = CacheFile::open(path, test_key());
+    ASSERT_TRUE(file != nullptr);
+    ASSERT_EQ(file->n_sequences(), 2U);
+    ASSERT_EQ(file->seq_id(0), 0);
+    ASSERT_EQ(file->seq_id(1), 7);
+    ASSERT_TRUE(file->tokens(0) == tokens_a);
+    ASSERT_TRUE(file->tokens(1) == tokens_b);
+    file.reset();
+
+    // Each payload starts on its own 4096-byte page
+    std::vector<uint8_t> bytes(std::filesystem::file_size(path));
+    {
+        std::ifstream in(path, std::ios::binary);
+        in.read(reinterpret_cast<char*>(bytes.data()),
+                static_cast<std::streamsize>(bytes.size()));
+    }
+    ASSERT_EQ(bytes.size(), 8192U + state_b.size());
+    ASSERT_TRUE(std::equal(state_a.begin(), state_a.end(), &bytes[4096]));
+    ASSERT_TRUE(std::equal(state_b.begin(), state_b.end(), &bytes[8192]));
+
+    // A payload cut short by a truncated file
+    std::filesystem::resize_file(path, bytes.size() - 1);
+    ASSERT_TRUE(CacheFile::open(path, test_key()) == nullptr);
+
+    // A corrupted size that would wrap around when added to its offset
+    std::filesystem::resize_file(path, bytes.size());
+    {
+        std::fstream io(path, std::ios::binary | std::ios::in | std::ios::out);
+        io.seekp(56 + 40 + 32); // state_size of the second entry
+        const uint64_t state_size = UINT64_MAX - 4096;
+        io.write(reinterpret_cast<const char*>(&state_size),
+                 sizeof(state_size));
+    }
+    ASSERT_TRUE(CacheFile::open(path, test_key()) == nullptr);
+
+    std::filesystem::remove(path);
+}
+
+TEST(test_sequence_state_round_trip)
+{
+    agent_cpp::SequenceState state;
+    state.key = test_key();
+    state.tokens = { 1, 2, 3 };
+    state.data = { 9, 8, 7, 6, 5 };
+
+    auto bytes = state.serialize();
+    auto decoded =
+      agent_cpp::SequenceState::deserialize(bytes.data(), bytes.size());
+    ASSERT_TRUE(decoded.has_value());
+    ASSERT_TRUE(decoded->key == state.key);
+    ASSERT_TRUE(decoded->tokens == state.tokens);
+    ASSERT_TRUE(decoded->data == state.data);
+
+    // Truncated, padded or corrupted input is rejected
+    ASSERT_TRUE(!agent_cpp::SequenceState::deserialize(bytes.data(),
+                                                       bytes.size() - 1));
+    bytes.push_back(0);
+    ASSERT_TRUE(!agent_cpp::SequenceState::deserialize(bytes.data(),
+                                                       bytes.size()));
+    bytes.pop_back();
+    bytes[0] = 'X';
+    ASSERT_TRUE(!agent_cpp::SequenceState::deserialize(bytes.data(),
+                                                       bytes.size()));
+}
+
+TEST(test_cache_directory_evicts_least_recently_used)
+{
+    namespace fs = std::filesystem;
+    const fs::path dir = temp_path("agent_cpp_test_cache_dir");
+    fs::remove_all(dir);
+    CacheDirectory cache_dir(dir.string(), 250);
+
+    const std::string path = cache_dir.path_for(0xabc);
+    ASSERT_STREQ(fs::path(path).filename().string().c_str(),
+                 "0000000000000abc.kvc");
+
+    // Oldest first: a, b, c, each 100 bytes
+    const auto now = fs::file_time_type::clock::now();
+    std::vector<std::string> paths;
+    for (uint64_t key = 1; key <= 3; key++) {
+        paths.push_back(cache_dir.path_for(key));
+        std::ofstream(paths.back(), std::ios::binary) << std::string(100, 'x');
+        fs::last_write_time(paths.back(), now - std::chrono::hours(4 - key));
+    }
+    std::ofstream(dir / "notes.txt") << std::string(1000, 'x');
+    ASSERT_EQ(cache_dir.size_bytes(), 300U);
+
+    // Using a makes b the least recently used
+    cache_dir.touch(paths[0]);
+    cache_dir.evict(paths[2]);
+    ASSERT_TRUE(fs::exists(paths[0]));
+    ASSERT_TRUE(!fs::exists(paths[1]));
+    ASSERT_TRUE(fs::exists(paths[2]));
+    ASSERT_TRUE(fs::exists(dir / "notes.txt"));
+
+    // The file just written is kept even when it alone is over the bound
+    CacheDirectory small_dir(dir.string(), 50);
+    small_dir.evict(paths[2]);
+    ASSERT_TRUE(!fs::exists(paths[0]));
+    ASSERT_TRUE(fs::exists(paths[2]));
+
+    // Eviction also removes temporary files left behind by crashed writers,
+    // but not ones that may still be being written
+    const std::string stale = paths[0] + ".tmp.123.0";
+    const std::string fresh = paths[0] + ".tmp.123.1";
+    std::ofstream(stale) << "x";
+    std::ofstream(fresh) << "x";
+    fs::last_write_time(stale, now - std::chrono::hours(2));
+    CacheDirectory unbounded_dir(dir.string());
+    unbounded_dir.evict();
+    ASSERT_TRUE(!fs::exists(stale));
+    ASSERT_TRUE(fs::exists(fresh));
+    ASSERT_TRUE(fs::exists(paths[2]));
+
+    fs::remove_all(dir);
+}
+
+int
+main()
+{
+    std::cout << "\n=== Running Cache File Unit Tests ===\n" << std::endl;
+
+    try {
+        RUN_TEST(test_fnv1a_64);
+        RUN_TEST(test_cache_file_checks_key);
+        RUN_TEST(test_cache_file_rejects_other_files);
+        RUN_TEST(test_cache_file_sequences_round_trip);
+        RUN_TEST(test_sequence_state_round_trip);
+        RUN_TEST(test_cache_directory_evicts_least_recently_used);
+
+        std::cout << "\n=== All tests passed! ✓ ===\n" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "\n✗ TEST FAILED: " << e.what() << std::endl;
+        return 1;
+    }
+}
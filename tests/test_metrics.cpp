@@ -0,0 +1,151 @@
+#include "error.h"
+#include "metrics/metrics.h"
+#include "metrics/metrics_callback.h"
+#include "test_utils.h"
+#include <memory>
+#include <string>
+
+using agent_cpp::MetricsCallback;
+using agent_cpp::MetricsRegistry;
+
+namespace {
+
+bool
+contains(const std::string& text, const std::string& needle)
+{
+    return text.find(needle) != std::string::npos;
+}
+
+} // namespace
+
+TEST(test_counter_render)
+{
+    MetricsRegistry registry;
+    registry.counter("calls_total", "Calls", { { "tool", "search" } }).inc();
+    registry.counter("calls_total", "Calls", { { "tool", "search" } }).inc(2);
+    registry.counter("calls_total", "Calls", { { "tool", "a\"b" } }).inc();
+
+    std::string text = registry.render();
+    ASSERT_TRUE(contains(text, "# HELP calls_total Calls\n"));
+    ASSERT_TRUE(contains(text, "# TYPE calls_total counter\n"));
+    ASSERT_TRUE(contains(text, "calls_total{tool=\"search\"} 3\n"));
+    ASSERT_TRUE(contains(text, "calls_total{tool=\"a\\\"b\"} 1\n"));
+}
+
+TEST(test_histogram_buckets_are_cumulative)
+{
+    MetricsRegistry registry;
+    auto& histogram =
+      registry.histogram("latency_seconds", "Latency", { 0.1, 1 });
+    histogram.observe(0.05);
+    histogram.observe(0.1);
+    histogram.observe(0.5);
+    histogram.observe(5);
+
+    ASSERT_EQ(histogram.count(), 4U);
+    std::string text = registry.render();
+    ASSERT_TRUE(contains(text, "# TYPE latency_seconds histogram\n"));
+    ASSERT_TRUE(contains(text, "latency_seconds_bucket{le=\"0.1\"} 2\n"));
+    ASSERT_TRUE(contains(text, "latency_seconds_bucket{le=\"1\"} 3\n"));
+    ASSERT_TRUE(contains(text, "latency_seconds_bucket{le=\"+Inf\"} 4\n"));
+    ASSERT_TRUE(contains(text, "latency_seconds_sum 5.65\n"));
+    ASSERT_TRUE(contains(text, "latency_seconds_count 4\n"));
+}
+
+TEST(test_metric_type_mismatch_throws)
+{
+    MetricsRegistry registry;
+    registry.counter("requests", "Requests");
+
+    bool threw = false;
+    try {
+        registry.histogram("requests", "Requests", { 1 });
+    } catch (const agent_cpp::Error&) {
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+}
+
+TEST(test_tool_duration_from_on_tool_stats)
+{
+    auto registry = std::make_shared<MetricsRegistry>();
+    MetricsCallback callback(registry);
+
+    // A skipped call reaches after_tool_execution without on_tool_stats
+    std::string name = "search";
+    agent_cpp::ToolResult skipped("{\"skipped\": \"no\"}");
+    callback.after_tool_execution(name, skipped);
+    callback.on_tool_stats(name, 250);
+    agent_cpp::ToolResult result("ok");
+    callback.after_tool_execution(name, result);
+
+    const std::string text = registry->render();
+    ASSERT_TRUE(
+      contains(text, "agent_cpp_tool_calls_total{tool=\"search\"} 2\n"));
+    ASSERT_TRUE(contains(
+      text, "agent_cpp_tool_duration_seconds_sum{tool=\"search\"} 0.25\n"));
+    ASSERT_TRUE(contains(
+      text, "agent_cpp_tool_duration_seconds_count{tool=\"search\"} 1\n"));
+}
+
+TEST(test_ttft_only_with_generated_tokens)
+{
+    auto registry = std::make_shared<MetricsRegistry>();
+    MetricsCallback callback(registry);
+
+    agent_cpp::GenerationStats stats;
+    stats.n_prompt_tokens = 10;
+    callback.on_llm_stats(stats);
+    stats.n_generated_tokens = 3;
+    stats.ttft_ms = 500;
+    callback.on_llm_stats(stats);
+
+    const std::string text = registry->render();
+    ASSERT_TRUE(contains(text, "agent_cpp_llm_calls_total 2\n"));
+    ASSERT_TRUE(
+      contains(text, "agent_cpp_llm_time_to_first_token_seconds_count 1\n"));
+    ASSERT_TRUE(
+      contains(text, "agent_cpp_llm_time_to_first_token_seconds_sum 0.5\n"));
+}
+
+TEST(test_mcp_request_observer)
+{
+    auto registry = std::make_shared<MetricsRegistry>();
+    auto observe = agent_cpp::make_mcp_request_observer(registry);
+
+    observe("tools/call", 0.25, true);
+    observe("tools/call", 0.5, false);
+    observe("resources/list", 1, false);
+
+    const std::string text = registry->render();
+    ASSERT_TRUE(contains(text,
+                         "agent_cpp_mcp_request_duration_seconds_count{"
+                         "method=\"tools/call\"} 2\n"));
+    ASSERT_TRUE(contains(text,
+                         "agent_cpp_mcp_request_errors_total{"
+                         "method=\"tools/call\"} 1\n"));
+    ASSERT_TRUE(contains(text,
+                         "agent_cpp_mcp_request_errors_total{"
+                         "method=\"resources/list\"} 1\n"));
+}
+
+int
+main()
+{
+    std::cout << "\n=== Running Metrics Unit Tests ===\n" << std::endl;
+
+    try {
+        RUN_TEST(test_counter_render);
+        RUN_TEST(test_histogram_buckets_are_cumulative);
+        RUN_TEST(test_metric_type_mismatch_throws);
+        RUN_TEST(test_tool_duration_from_on_tool_stats);
+        RUN_TEST(test_ttft_only_with_generated_tokens);
+        RUN_TEST(test_mcp_request_observer);
+
+        std::cout << "\n=== All tests passed! ✓ ===\n" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "\n✗ TEST FAILED: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,84 @@
+#include "model_pool.h"
+#include "test_utils.h"
+#include <vector>
+
+using agent_cpp::shared_prefix_length;
+
+namespace {
+
+constexpr llama_token BOS = 1;
+
+// The context ModelPool::acquire picks among idle ones: the longest shared
+// prefix, the first on ties
+size_t
+route(const std::vector<std::vector<llama_token>>& contexts,
+      const std::vector<llama_token>& prompt)
+{
+    size_t best = 0;
+    size_t best_shared = 0;
+    for (size_t i = 0; i < contexts.size(); i++) {
+        const size_t shared = shared_prefix_length(contexts[i], prompt, BOS);
+        if (shared > best_shared) {
+            best = i;
+            best_shared = shared;
+        }
+    }
+    return best;
+}
+
+}
+
+TEST(test_shared_prefix_length_skips_leading_bos)
+{
+    ASSERT_EQ(shared_prefix_length({ BOS, 5, 6, 7 }, { 5, 6, 8 }, BOS), 2U);
+    ASSERT_EQ(shared_prefix_length({ 5, 6, 7 }, { BOS, 5, 6, 7 }, BOS), 3U);
+    ASSERT_EQ(shared_prefix_length({ BOS, 5 }, { BOS, 5, 6 }, BOS), 1U);
+    ASSERT_EQ(shared_prefix_length({}, { BOS, 5 }, BOS), 0U);
+    ASSERT_EQ(shared_prefix_length({ BOS }, {}, BOS), 0U);
+}
+
+TEST(test_second_turn_routes_to_its_context)
+{
+    // Two conversations with the same system prompt (5, 6). Each context
+    // holds its first turn: BOS, the prompt, then the generated reply.
+    const std::vector<std::vector<llama_token>> contexts = {
+        { BOS, 5, 6, 20, 21, 30, 31 },
+        { BOS, 5, 6, 10, 11, 40, 41 },
+    };
+
+    // The second turn of the conversation in context 1, tokenized for a
+    // context that is no longer empty, so without BOS
+    const std::vector<llama_token> second_turn = { 5,  6,  10, 11,
+                                                   40, 41, 12, 13 };
+    ASSERT_EQ(route(contexts, second_turn), 1U);
+    ASSERT_EQ(shared_prefix_length(contexts[1], second_turn, BOS), 6U);
+
+    // Routing tokens rendered with BOS land on the same context
+    std::vector<llama_token> with_bos = second_turn;
+    with_bos.insert(with_bos.begin(), BOS);
+    ASSERT_EQ(route(contexts, with_bos), 1U);
+
+    // After the second turn the context may hold the prompt without BOS
+    const std::vector<std::vector<llama_token>> later = {
+        contexts[0],
+        second_turn,
+    };
+    ASSERT_EQ(route(later, { BOS, 5, 6, 10, 11, 40, 41, 12, 13, 14 }), 1U);
+}
+
+int
+main()
+{
+    std::cout << "\n=== Running Model Pool Unit Tests ===\n" << std::endl;
+
+    try {
+        RUN_TEST(test_shared_prefix_length_skips_leading_bos);
+        RUN_TEST(test_second_turn_routes_to_its_context);
+
+        std::cout << "\n=== All tests passed! ✓ ===\n" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "\n✗ TEST FAILED: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,114 @@
+#include "prompt_cache.h"
+#include "test_utils.h"
+#include <vector>
+
+using agent_cpp::PromptCache;
+
+namespace {
+
+std::vector<uint8_t>
+make_state(size_t size, uint8_t value)
+{
+    return std::vector<uint8_t>(size, value);
+}
+
+}
+
+TEST(test_prompt_cache_empty_lookup)
+{
+    PromptCache cache(1024);
+    auto match = cache.lookup({ 1, 2, 3 });
+    ASSERT_TRUE(match.state == nullptr);
+    ASSERT_EQ(match.n_matched, 0);
+}
+
+TEST(test_prompt_cache_exact_and_prefix_match)
+{
+    PromptCache cache(1024);
+    cache.insert({ 1, 2, 3, 4 }, make_state(8, 1));
+
+    auto exact = cache.lookup({ 1, 2, 3, 4, 5 });
+    ASSERT_TRUE(exact.state != nullptr);
+    ASSERT_EQ(exact.n_matched, 4);
+    ASSERT_EQ(exact.tokens, (std::vector<llama_token>{ 1, 2, 3, 4 }));
+
+    // A query diverging mid-entry still reuses the shared part of the state
+    auto partial = cache.lookup({ 1, 2, 9 });
+    ASSERT_TRUE(partial.state != nullptr);
+    ASSERT_EQ(partial.n_matched, 2);
+    ASSERT_EQ(partial.tokens, (std::vector<llama_token>{ 1, 2, 3, 4 }));
+
+    auto miss = cache.lookup({ 7, 8 });
+    ASSERT_TRUE(miss.state == nullptr);
+}
+
+TEST(test_prompt_cache_interleaved_conversations)
+{
+    PromptCache cache(1024);
+    // Two conversations sharing a system prompt {1, 2}
+    cache.insert({ 1, 2, 10, 11 }, make_state(8, 1));
+    cache.insert({ 1, 2, 20, 21, 22 }, make_state(8, 2));
+    ASSERT_EQ(cache.n_entries(), 2);
+
+    auto first = cache.lookup({ 1, 2, 10, 11, 12 });
+    ASSERT_EQ(first.n_matched, 4);
+    ASSERT_EQ((*first.state)[0], 1);
+
+    auto second = cache.lookup({ 1, 2, 20, 21, 22, 23 });
+    ASSERT_EQ(second.n_matched, 5);
+    ASSERT_EQ((*second.state)[0], 2);
+
+    // Replacing the state for the same tokens does not add an entry
+    cache.insert({ 1, 2, 10, 11 }, make_state(4, 3));
+    ASSERT_EQ(cache.n_entries(), 2);
+    ASSERT_EQ(cache.size_bytes(), 12);
+}
+
+TEST(test_prompt_cache_lru_eviction)
+{
+    PromptCache cache(20);
+    cache.insert({ 1, 2, 3 }, make_state(8, 1));
+    cache.insert({ 1, 2, 4 }, make_state(8, 2));
+
+    // Touch the first entry so the second becomes least recently used
+    cache.lookup({ 1, 2, 3 });
+
+    cache.insert({ 5, 6 }, make_state(8, 3));
+    ASSERT_EQ(cache.n_entries(), 2);
+    ASSERT_TRUE(cache.size_bytes() <= 20);
+
+    auto evicted = cache.lookup({ 1, 2, 4 });
+    ASSERT_EQ(evicted.n_matched, 2); // Only the shared prefix remains cached
+    ASSERT_EQ(evicted.tokens, (std::vector<llama_token>{ 1, 2, 3 }));
+
+    auto kept = cache.lookup({ 5, 6 });
+    ASSERT_EQ(kept.n_matched, 2);
+}
+
+TEST(test_prompt_cache_oversized_state_ignored)
+{
+    PromptCache cache(4);
+    cache.insert({ 1, 2 }, make_state(8, 1));
+    ASSERT_EQ(cache.n_entries(), 0);
+    ASSERT_EQ(cache.size_bytes(), 0);
+}
+
+int
+main()
+{
+    std::cout << "\n=== Running Prompt Cache Unit Tests ===\n" << std::endl;
+
+    try {
+        RUN_TEST(test_prompt_cache_empty_lookup);
+        RUN_TEST(test_prompt_cache_exact_and_prefix_match);
+        RUN_TEST(test_prompt_cache_interleaved_conversations);
+        RUN_TEST(test_prompt_cache_lru_eviction);
+        RUN_TEST(test_prompt_cache_oversized_state_ignored);
+
+        std::cout << "\n=== All tests passed! ✓ ===\n" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "\n✗ TEST FAILED: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,95 @@
+#include "stream_buffer.h"
+#include "test_utils.h"
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using agent_cpp::StreamBuffer;
+using agent_cpp::utf8_complete_length;
+
+TEST(test_utf8_complete_length)
+{
+    ASSERT_EQ(utf8_complete_length(""), 0U);
+    ASSERT_EQ(utf8_complete_length("abc"), 3U);
+    // "é" is C3 A9, "€" is E2 82 AC, "😀" is F0 9F 98 80
+    ASSERT_EQ(utf8_complete_length("a\xC3"), 1U);
+    ASSERT_EQ(utf8_complete_length("a\xC3\xA9"), 3U);
+    ASSERT_EQ(utf8_complete_length("\xE2\x82"), 0U);
+    ASSERT_EQ(utf8_complete_length("\xE2\x82\xAC"), 3U);
+    ASSERT_EQ(utf8_complete_length("x\xF0\x9F\x98"), 1U);
+    ASSERT_EQ(utf8_complete_length("x\xF0\x9F\x98\x80"), 5U);
+    // Stray continuation bytes are passed on rather than held forever
+    ASSERT_EQ(utf8_complete_length("\x80\x80\x80\x80\x80"), 5U);
+}
+
+TEST(test_stream_buffer_joins_split_characters)
+{
+    std::vector<std::string> chunks;
+    StreamBuffer stream(
+      [&chunks](const std::string& chunk) { chunks.push_back(chunk); });
+
+    stream.add("caf\xC3");
+    stream.add("\xA9 \xF0\x9F");
+    stream.add("\x98\x80");
+    stream.flush();
+
+    ASSERT_EQ(chunks.size(), 3U);
+    ASSERT_STREQ(chunks[0].c_str(), "caf");
+    ASSERT_STREQ(chunks[1].c_str(), "\xC3\xA9 ");
+    ASSERT_STREQ(chunks[2].c_str(), "\xF0\x9F\x98\x80");
+}
+
+TEST(test_stream_buffer_batches_by_bytes)
+{
+    std::vector<std::string> chunks;
+    StreamBuffer stream(
+      [&chunks](const std::string& chunk) { chunks.push_back(chunk); }, 8);
+
+    for (const char* piece : { "one ", "two ", "six" }) {
+        stream.add(piece);
+    }
+    ASSERT_EQ(chunks.size(), 1U);
+    ASSERT_STREQ(chunks[0].c_str(), "one two ");
+
+    stream.flush();
+    ASSERT_EQ(chunks.size(), 2U);
+    ASSERT_STREQ(chunks[1].c_str(), "six");
+}
+
+TEST(test_stream_buffer_batches_by_delay)
+{
+    std::vector<std::string> chunks;
+    StreamBuffer stream(
+      [&chunks](const std::string& chunk) { chunks.push_back(chunk); },
+      0,
+      std::chrono::milliseconds(20));
+
+    stream.add("a");
+    stream.add("b");
+    ASSERT_TRUE(chunks.empty());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    stream.add("c");
+    ASSERT_EQ(chunks.size(), 1U);
+    ASSERT_STREQ(chunks[0].c_str(), "abc");
+}
+
+int
+main()
+{
+    std::cout << "\n=== Running Stream Buffer Unit Tests ===\n" << std::endl;
+
+    try {
+        RUN_TEST(test_utf8_complete_length);
+        RUN_TEST(test_stream_buffer_joins_split_characters);
+        RUN_TEST(test_stream_buffer_batches_by_bytes);
+        RUN_TEST(test_stream_buffer_batches_by_delay);
+
+        std::cout << "\n=== All tests passed! ✓ ===\n" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "\n✗ TEST FAILED: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,110 @@
+#include "test_utils.h"
+#include "tool_executor.h"
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using agent_cpp::ToolExecutor;
+using agent_cpp::ToolResult;
+
+TEST(test_tool_executor_returns_results_in_submit_order)
+{
+    ToolExecutor executor(4);
+    std::vector<std::future<ToolResult>> futures;
+    for (int i = 0; i < 8; i++) {
+        futures.push_back(executor.submit([i]() {
+            // Later tasks finish first
+            std::this_thread::sleep_for(std::chrono::milliseconds(8 - i));
+            return ToolResult(std::to_string(i));
+        }));
+    }
+
+    for (int i = 0; i < 8; i++) {
+        ASSERT_STREQ(futures[i].get().output().c_str(),
+                     std::to_string(i).c_str());
+    }
+}
+
+TEST(test_tool_executor_runs_tasks_concurrently)
+{
+    ToolExecutor executor(3);
+    std::atomic<int> running{ 0 };
+    std::atomic<int> max_running{ 0 };
+
+    std::vector<std::future<ToolResult>> futures;
+    for (int i = 0; i < 3; i++) {
+        futures.push_back(executor.submit([&]() {
+            int now = ++running;
+            int seen = max_running.load();
+            while (now > seen &&
+                   !max_running.compare_exchange_weak(seen, now)) {
+            }
+            // Wait until all three tasks overlap (or give up)
+            auto deadline =
+              std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while (max_running.load() < 3 &&
+                   std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::yield();
+            }
+            --running;
+            return ToolResult("ok");
+        }));
+    }
+
+    for (auto& future : futures) {
+        future.get();
+    }
+    ASSERT_EQ(max_running.load(), 3);
+}
+
+TEST(test_tool_executor_propagates_exceptions)
+{
+    ToolExecutor executor(1);
+    auto future = executor.submit([]() -> ToolResult {
+        throw std::runtime_error("boom");
+    });
+
+    bool caught = false;
+    try {
+        future.get();
+    } catch (const std::runtime_error& e) {
+        caught = std::string(e.what()) == "boom";
+    }
+    ASSERT_TRUE(caught);
+}
+
+TEST(test_tool_executor_finishes_queued_tasks_on_destruction)
+{
+    std::atomic<int> completed{ 0 };
+    {
+        ToolExecutor executor(1);
+        for (int i = 0; i < 5; i++) {
+            executor.submit([&completed]() {
+                completed++;
+                return ToolResult("");
+            });
+        }
+    }
+    ASSERT_EQ(completed.load(), 5);
+}
+
+int
+main()
+{
+    std::cout << "\n=== Running Tool Executor Unit Tests ===\n" << std::endl;
+
+    try {
+        RUN_TEST(test_tool_executor_returns_results_in_submit_order);
+        RUN_TEST(test_tool_executor_runs_tasks_concurrently);
+        RUN_TEST(test_tool_executor_propagates_exceptions);
+        RUN_TEST(test_tool_executor_finishes_queued_tasks_on_destruction);
+
+        std::cout << "\n=== All tests passed! ✓ ===\n" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "\n✗ TEST FAILED: " << e.what() << std::endl;
+        return 1;
+    }
+}